@@ -0,0 +1,22 @@
+# sampling throughput of the keyframe tracks of test/Animation.h (no OpenGL context or armadillo needed)
+#
+#    $ qmake Qt5-OpenGL11-animationbench.pro
+#    $ make
+#    $ ./qt5-opengl11-animationbench
+
+TARGET = qt5-opengl11-animationbench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+QMAKE_CXXFLAGS += -std=c++11 -O2
+INCLUDEPATH += test/
+
+SOURCES += \
+    bench/AnimationBench.cpp \
+    test/Animation.cpp
+
+HEADERS += \
+    test/Animation.h \
+    test/geom.h \
+    test/geom_soa.h \
+    test/geom_soa_kernels.h
@@ -0,0 +1,30 @@
+# CPU benchmarks of the sample application (no OpenGL context needed)
+#
+#    $ qmake Qt5-OpenGL11-bench.pro
+#    $ make
+#    $ ./qt5-opengl11-bench
+
+TARGET = qt5-opengl11-bench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+QMAKE_CXXFLAGS += -std=c++11 -O2
+LIBS += -lyaml-cpp -larmadillo
+INCLUDEPATH += src/ test/
+
+SOURCES += \
+    bench/SceneBench.cpp \
+    test/CompiledScene.cpp \
+    test/SceneGraph.cpp \
+    test/Animation.cpp
+
+HEADERS += \
+    test/CompiledScene.h \
+    test/SceneGraph.h \
+    test/Animation.h \
+    test/geom_soa.h \
+    test/geom_soa_kernels.h \
+    test/geom.h
+
+DEFINES += \
+USE_ARMADILLO
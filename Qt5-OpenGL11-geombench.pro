@@ -0,0 +1,20 @@
+# throughput and accuracy of the geom_soa.h batch kernels (no OpenGL context or armadillo needed)
+#
+#    $ qmake Qt5-OpenGL11-geombench.pro
+#    $ make
+#    $ ./qt5-opengl11-geombench
+
+TARGET = qt5-opengl11-geombench
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+QMAKE_CXXFLAGS += -std=c++11 -O2
+INCLUDEPATH += test/
+
+SOURCES += \
+    bench/GeomBench.cpp
+
+HEADERS += \
+    test/geom.h \
+    test/geom_soa.h \
+    test/geom_soa_kernels.h
@@ -0,0 +1,55 @@
+# offscreen renderer of the sample scene: EGL context, no window, no Qt
+#
+#    $ qmake Qt5-OpenGL11-headless.pro
+#    $ make
+#    $ mkdir frames && ./qt5-opengl11-headless -n 600 -o frames
+
+TARGET = qt5-opengl11-headless
+TEMPLATE = app
+CONFIG += console
+CONFIG -= qt
+QMAKE_CXXFLAGS += -std=c++11
+LIBS += -lyaml-cpp -larmadillo -lEGL -lGL -ldl -lpthread
+INCLUDEPATH += src/ include/ deps/lodepng
+LIBPATH += deps/glxw/
+
+SOURCES += \
+    src/glxw.c \
+    test/headless.cpp \
+    test/HeadlessContext.cpp \
+    test/SimpleGLScene.cpp \
+    test/Projection.cpp \
+    test/CompiledScene.cpp \
+    test/SceneGraph.cpp \
+    test/Animation.cpp \
+    test/DepthOfField.cpp \
+    test/FileWatcher.cpp \
+    deps/lodepng/lodepng.cpp
+
+HEADERS += \
+    src/OpenGL++11.h \
+    test/geom.h \
+    test/GLScene.h \
+    test/HeadlessContext.h \
+    test/SimpleGLScene.h \
+    test/Projection.h \
+    test/CompiledScene.h \
+    test/SceneGraph.h \
+    test/Animation.h \
+    test/geom_soa.h \
+    test/geom_soa_kernels.h \
+    test/DepthOfField.h \
+    test/FileWatcher.h
+
+DEFINES += \
+USE_ARMADILLO
+
+CONFIG(release, debug|release): DEFINES += OPENGL11_NO_ERROR_CHECK
+
+glxw.target = \
+    src/glxw.c
+
+glxw.commands = \
+    python deps/glxw/glxw_gen.py
+
+QMAKE_EXTRA_TARGETS += glxw
@@ -6,7 +6,7 @@ TARGET = qt5-opengl11-test
 TEMPLATE = app
 QMAKE_CXX = gcc
 QMAKE_CXXFLAGS += -std=c++11 -g
-LIBS += -lyaml-cpp -ldl -larmadillo
+LIBS += -lyaml-cpp -ldl -larmadillo -lpthread
 INCLUDEPATH += src/ include/ deps/lodepng
 LIBPATH += deps/glxw/
 
@@ -16,6 +16,11 @@ SOURCES += \
     test/SimpleGLWindow.cpp \
     test/SimpleGLScene.cpp \
     test/Projection.cpp \
+    test/CompiledScene.cpp \
+    test/SceneGraph.cpp \
+    test/Animation.cpp \
+    test/DepthOfField.cpp \
+    test/FileWatcher.cpp \
     deps/lodepng/lodepng.cpp
 
 HEADERS += \
@@ -25,10 +30,20 @@ HEADERS += \
     test/GLScene.h \
     test/SimpleGLScene.h \
     test/Projection.h \
+    test/CompiledScene.h \
+    test/SceneGraph.h \
+    test/Animation.h \
+    test/geom_soa.h \
+    test/geom_soa_kernels.h \
+    test/DepthOfField.h \
+    test/FileWatcher.h \
 
 DEFINES += \
 USE_ARMADILLO
 
+# GL_CHECK_ERROR() is compiled out in release builds
+CONFIG(release, debug|release): DEFINES += OPENGL11_NO_ERROR_CHECK
+
 glxw.target = \
     src/glxw.c
 
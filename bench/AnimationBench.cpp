@@ -0,0 +1,112 @@
+/*
+ * sampling throughput of the keyframe tracks of test/Animation.h
+ *
+ *   pair      per track: binary search for the segment, then geom::unit_slerp_interpolater
+ *             for the rotation of its two keys, as single-pair code would do
+ *   batch     Animation::sample() per instruction set, with the default nlerp threshold and
+ *             with slerp only (threshold 0)
+ *
+ * every frame advances the time by 1/60 s. The largest difference of a sampled rotation from
+ * the pair result is printed next to the throughput; the program fails if it exceeds the tolerance.
+ */
+#include "Animation.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+static const float TOLERANCE = 1e-5f;
+static const size_t TRACKS = 10000, KEYS = 16;
+static const float FRAME = 1.0f / 60.0f;
+
+static double samplesPerSecond(const std::function<void ()> &frame) {
+  typedef std::chrono::steady_clock clock;
+  int frames = 0;
+  clock::time_point start = clock::now(), now;
+  do {
+    frame();
+    frames++;
+    now = clock::now();
+  } while (now - start < std::chrono::milliseconds(300) || frames < 3);
+  return frames * TRACKS / std::chrono::duration<double>(now - start).count();
+}
+
+// single-pair sampling of one track at time t (within the keys)
+static geom::fquaternion samplePair(const std::vector<Animation::Key> &keys, float t) {
+  size_t k = std::upper_bound(keys.begin(), keys.end(), t, [](float t, const Animation::Key &key) { return t < key.time; }) - keys.begin();
+  k = std::min(std::max(k, (size_t) 1), keys.size() - 1) - 1;
+  float u = std::min(std::max((t - keys[k].time) / (keys[k + 1].time - keys[k].time), 0.0f), 1.0f);
+  geom::fquaternion a = keys[k].transform.rot, b = keys[k + 1].transform.rot;
+  if (a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z < 0.0f) {
+    b = -b;
+  }
+  return geom::unit_slerp_interpolater<float>(a, b)(u);
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::normal_distribution<float> normal;
+  std::uniform_real_distribution<float> interval(0.2f, 1.0f), position(-10.0f, 10.0f);
+  // rotation steps between keys from 0.01 to 1 rad, so both nlerp and slerp segments occur
+  std::uniform_real_distribution<float> step(std::log(0.01f), std::log(1.0f));
+  std::vector<std::vector<Animation::Key>> tracks(TRACKS);
+  for (std::vector<Animation::Key> &keys : tracks) {
+    float time = 0.0f;
+    geom::fquaternion rot = geom::normalize(geom::fquaternion(normal(rng), normal(rng), normal(rng), normal(rng)));
+    for (size_t k = 0; k < KEYS; k++) {
+      keys.push_back(Animation::Key { time, geom::ftransform(geom::fquaternion(0.0f, position(rng), position(rng), position(rng)), rot, 1.0f) });
+      time += interval(rng);
+      geom::fquaternion axis = geom::normalize(geom::fquaternion(0.0f, normal(rng), normal(rng), normal(rng)));
+      rot = geom::rotate(std::exp(step(rng)), axis.x, axis.y, axis.z).rot * rot;
+    }
+  }
+  // every track stays within its keys
+  float duration = tracks[0].back().time;
+  for (const std::vector<Animation::Key> &keys : tracks) {
+    duration = std::min(duration, keys.back().time);
+  }
+
+  std::vector<geom::fquaternion> reference(TRACKS, geom::fquaternion(1.0f));
+  float time = 0.0f;
+  double pair = samplesPerSecond([&]() {
+    time = std::fmod(time + FRAME, duration);
+    for (size_t i = 0; i < TRACKS; i++) {
+      reference[i] = samplePair(tracks[i], time);
+    }
+  });
+  std::printf("%8s %10s %16s %8s %8s %12s\n", "method", "isa", "samples/s", "nlerp", "slerp", "max diff");
+  std::printf("%8s %10s %16.4g %8s %8zu %12s\n", "pair", "scalar", pair, "-", TRACKS, "-");
+
+  bool ok = true;
+  for (float threshold : { Animation::DEFAULT_NLERP_THRESHOLD, 0.0f }) {
+    for (geom::simd::isa isa : { geom::simd::SCALAR, geom::simd::SSE2, geom::simd::AVX2, geom::simd::NEON }) {
+      geom::simd::select(isa);
+      if (geom::simd::active() != isa) {
+        continue;
+      }
+      Animation animation(threshold);
+      for (const std::vector<Animation::Key> &keys : tracks) {
+        animation.addTrack(keys, false);
+      }
+      float time = 0.0f;
+      double batch = samplesPerSecond([&]() {
+        time = std::fmod(time + FRAME, duration);
+        animation.sample(time);
+      });
+      // accuracy at one more time, against the pair code
+      const geom::ftransform_soa &sampled = animation.sample(0.37f * duration);
+      float diff = 0.0f;
+      for (size_t i = 0; i < TRACKS; i++) {
+        geom::fquaternion d = sampled.rot.get(i) - samplePair(tracks[i], 0.37f * duration);
+        diff = std::max(diff, geom::abs(d));
+      }
+      ok = ok && diff <= TOLERANCE;
+      std::printf("%8s %10s %16.4g %8zu %8zu %12.3g%s\n", threshold ? "batch" : "slerp", geom::simd::name(isa), batch,
+                  animation.nlerpCount(), animation.slerpCount(), diff, diff <= TOLERANCE ? "" : "  MISMATCH");
+    }
+  }
+  return ok ? 0 : 1;
+}
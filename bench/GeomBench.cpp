@@ -0,0 +1,149 @@
+/*
+ * throughput of the geom_soa.h batch kernels per instruction set, against the scalar templates
+ *
+ *   every kernel is run on the same random input with each instruction set the CPU supports;
+ *   the largest difference from the scalar result is printed next to the time per element,
+ *   and the program fails if it exceeds the tolerance.
+ */
+#include "geom_soa.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <vector>
+
+static const float TOLERANCE = 1e-5f;
+
+static geom::fquaternion randomUnit(std::mt19937 &rng) {
+  std::normal_distribution<float> n;
+  return geom::normalize(geom::fquaternion(n(rng), n(rng), n(rng), n(rng)));
+}
+
+static double nanosecondsPerElement(size_t count, const std::function<void ()> &kernel) {
+  typedef std::chrono::steady_clock clock;
+  int runs = 0;
+  clock::time_point start = clock::now(), now;
+  do {
+    kernel();
+    runs++;
+    now = clock::now();
+  } while (now - start < std::chrono::milliseconds(200) || runs < 3);
+  return std::chrono::duration<double, std::nano>(now - start).count() / runs / count;
+}
+
+static float maxDifference(const std::vector<float> &a, const std::vector<float> &b) {
+  float d = 0.0f;
+  for (size_t i = 0; i < a.size(); i++) {
+    d = std::max(d, std::fabs(a[i] - b[i]));
+  }
+  return d;
+}
+
+// the components of an output, concatenated for comparison
+static std::vector<float> flatten(const geom::fquaternion_soa &q) {
+  std::vector<float> v(q.w);
+  v.insert(v.end(), q.x.begin(), q.x.end());
+  v.insert(v.end(), q.y.begin(), q.y.end());
+  v.insert(v.end(), q.z.begin(), q.z.end());
+  return v;
+}
+
+static std::vector<float> flatten(const geom::ftransform_soa &t) {
+  std::vector<float> v(flatten(t.rot));
+  v.insert(v.end(), t.x.begin(), t.x.end());
+  v.insert(v.end(), t.y.begin(), t.y.end());
+  v.insert(v.end(), t.z.begin(), t.z.end());
+  v.insert(v.end(), t.scale.begin(), t.scale.end());
+  return v;
+}
+
+int main() {
+  // 1 element past a multiple of every vector width, so the scalar tail runs too
+  const size_t count = 100001;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f), scale(0.5f, 2.0f);
+  geom::fquaternion_soa a, b, v;
+  geom::ftransform_soa t1, t2;
+  // interpolation parameters; b[i] is on the same side as a[i], theta[i] the angle between them
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  std::vector<float> theta, u;
+  for (size_t i = 0; i < count; i++) {
+    a.push_back(randomUnit(rng));
+    b.push_back(randomUnit(rng));
+    geom::fquaternion qa = a.get(i), qb = b.get(i);
+    float dot = qa.w * qb.w + qa.x * qb.x + qa.y * qb.y + qa.z * qb.z;
+    if (dot < 0.0f) {
+      b.set(i, -qb);
+    }
+    theta.push_back(std::acos(std::min(std::fabs(dot), 1.0f)));
+    u.push_back(unit(rng));
+    v.push_back(geom::fquaternion(0.0f, position(rng), position(rng), position(rng)));
+    t1.push_back(geom::ftransform(geom::fquaternion(0.0f, position(rng), position(rng), position(rng)), randomUnit(rng), scale(rng)));
+    t2.push_back(geom::ftransform(geom::fquaternion(0.0f, position(rng), position(rng), position(rng)), randomUnit(rng), scale(rng)));
+  }
+  // positions are ~100, so compare them relative to their magnitude
+  const float positionScale = 400.0f;
+  // bounding spheres at the positions of t1, culled against a 60 degree frustum looking down -z
+  geom::fsphere_soa spheres;
+  spheres.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    spheres.set(i, t1.get(i).pos, 10.0f * t1.scale[i]);
+  }
+  float planes[24], f = 1.0f / std::tan(0.5236f);
+  const float projection[16] = { f, 0, 0, 0,  0, f, 0, 0,  0, 0, -1.01f, -1,  0, 0, -2.01f, 0 };
+  geom::frustum_planes(projection, planes);
+  std::vector<float> distances;
+
+  std::vector<geom::simd::isa> isas = { geom::simd::SCALAR };
+  for (geom::simd::isa isa : { geom::simd::SSE2, geom::simd::AVX2, geom::simd::NEON }) {
+    geom::simd::select(isa);
+    if (geom::simd::active() == isa) {
+      isas.push_back(isa);
+    }
+  }
+
+  struct Kernel {
+    const char *name;
+    float tolerance;
+    std::function<void ()> run;
+    std::function<std::vector<float> ()> result;
+  };
+  geom::fquaternion_soa q;
+  geom::ftransform_soa t;
+  std::vector<float> matrices(16 * count);
+  // stream_matrices() wants 32-byte aligned output for AVX2
+  std::vector<float> streamStorage(16 * count + 8);
+  float *streamed = streamStorage.data() + (32 - (uintptr_t) streamStorage.data() % 32) % 32 / sizeof(float);
+  std::vector<Kernel> kernels = {
+    { "mul",         TOLERANCE, [&]() { geom::mul(a, b, q); }, [&]() { return flatten(q); } },
+    { "qrot",        TOLERANCE * positionScale, [&]() { geom::qrot(a, v, q); }, [&]() { return flatten(q); } },
+    { "normalize",   TOLERANCE, [&]() { geom::normalize(v, q); }, [&]() { return flatten(q); } },
+    { "compose",     TOLERANCE * positionScale, [&]() { geom::compose(t1, t2, t); }, [&]() { return flatten(t); } },
+    { "nlerp",       TOLERANCE, [&]() { geom::nlerp(a, b, u, q); }, [&]() { return flatten(q); } },
+    { "slerp",       TOLERANCE, [&]() { geom::slerp(a, b, theta, u, q); }, [&]() { return flatten(q); } },
+    { "cull",        TOLERANCE * positionScale, [&]() { geom::plane_distances(spheres, planes, 6, distances); }, [&]() { return distances; } },
+    { "to_matrices", TOLERANCE * positionScale, [&]() { geom::to_matrices(t1, matrices.data()); }, [&]() { return matrices; } },
+    { "stream",      TOLERANCE * positionScale, [&]() { geom::stream_matrices(t1, streamed); },
+      [&]() { return std::vector<float>(streamed, streamed + 16 * count); } },
+  };
+
+  bool ok = true;
+  std::printf("%12s %8s %12s %12s\n", "kernel", "isa", "ns/element", "max diff");
+  for (const Kernel &kernel : kernels) {
+    geom::simd::select(geom::simd::SCALAR);
+    kernel.run();
+    std::vector<float> reference = kernel.result();
+    for (geom::simd::isa isa : isas) {
+      geom::simd::select(isa);
+      kernel.run();
+      float diff = maxDifference(reference, kernel.result());
+      double ns = nanosecondsPerElement(count, kernel.run);
+      ok = ok && diff <= kernel.tolerance;
+      std::printf("%12s %8s %12.3f %12.3g%s\n", kernel.name, geom::simd::name(isa), ns, diff,
+                  diff <= kernel.tolerance ? "" : "  MISMATCH");
+    }
+  }
+  return ok ? 0 : 1;
+}
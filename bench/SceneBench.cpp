@@ -0,0 +1,140 @@
+/*
+ * per-frame CPU cost of feeding the scene primitives to the GPU, against the primitive count:
+ *
+ *   yaml      walk the YAML tree every frame (node lookups, string to float conversions,
+ *             model matrix) as SimpleGLScene::render did before the scene was compiled
+ *   compiled  stream the arrays of compileScene() into an instance buffer
+ *
+ * no OpenGL context is needed; both write into the same CPU-side staging area.
+ *
+ * then the per-frame cost of the scene graph, 100 assemblies of 1000 parts each, against the
+ * number of assemblies moved per frame:
+ *
+ *   full         every world transform recomputed
+ *   incremental  only the subtrees of the moved assemblies (SceneGraph::update())
+ */
+#include "CompiledScene.h"
+#include "geom.h"
+#include <armadillo>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+static YAML::Node generateScene(size_t count) {
+  std::stringstream yaml;
+  for (size_t i = 0; i < count; i++) {
+    float x = (float) (i % 100), y = (float) (i / 100);
+    switch (i % 3) {
+      case 0:
+        yaml << "- helix: { r: 3.0, width: 1.0, angle: 40.0, helix_angle: 0.4, position: [" << x << ", " << y << ", 0.0] }\n";
+        break;
+      case 1:
+        yaml << "- line: { width: 1.0, len: 10.0, position: [" << x << ", " << y << ", 0.0] }\n";
+        break;
+      default:
+        yaml << "- clothoid: { width: 1.0, angle: 3.0, slope_angle: 0.2, len: 10.0, position: [" << x << ", " << y << ", 0.0] }\n";
+    }
+  }
+  return YAML::Load(yaml.str());
+}
+
+// the per-object part of the former SimpleGLScene::render, uploads replaced by stores
+static void frameFromYaml(const YAML::Node &sceneNode, float *staging) {
+  for (size_t i = 0; i < sceneNode.size(); i++) {
+    YAML::Node node_type = sceneNode[i];
+    YAML::Node node;
+    float *out = staging + 20 * i;
+    if (node_type["helix"]) {
+      node = node_type["helix"];
+      out[16] = node["r"].as<float>();
+      out[17] = node["width"].as<float>();
+      out[18] = node["angle"].as<float>();
+      out[19] = node["helix_angle"].as<float>();
+    } else if (node_type["line"]) {
+      node = node_type["line"];
+      out[16] = node["width"].as<float>();
+      out[17] = node["len"].as<float>();
+    } else if (node_type["clothoid"]) {
+      node = node_type["clothoid"];
+      out[16] = node["width"].as<float>();
+      out[17] = node["angle"].as<float>();
+      out[18] = node["slope_angle"].as<float>();
+      out[19] = node["len"].as<float>();
+    } else {
+      continue;
+    }
+    std::vector<float> p = node["position"].as<std::vector<float>>();
+    arma::fmat::fixed<4, 4> model = geom::translate(p);
+    memcpy(out, model.memptr(), 16 * sizeof(float));
+  }
+}
+
+static void frameFromCompiled(const CompiledScene &scene, float *staging) {
+  float *models = staging, *params = staging + 16 * scene.size();
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    const PrimitiveArrays &arrays = scene.primitives[type];
+    memcpy(models, arrays.models.data(), arrays.models.size() * sizeof(float));
+    memcpy(params, arrays.params.data(), arrays.params.size() * sizeof(float));
+    models += arrays.models.size();
+    params += arrays.params.size();
+  }
+}
+
+template <typename F>
+static double millisecondsPerFrame(F frame) {
+  typedef std::chrono::steady_clock clock;
+  int frames = 0;
+  clock::time_point start = clock::now(), now;
+  do {
+    frame();
+    frames++;
+    now = clock::now();
+  } while (now - start < std::chrono::milliseconds(200) || frames < 3);
+  return std::chrono::duration<double, std::milli>(now - start).count() / frames;
+}
+
+int main() {
+  std::printf("%10s %14s %14s %14s\n", "primitives", "compile [ms]", "yaml [ms/f]", "compiled [ms/f]");
+  for (size_t count = 100; count <= 100000; count *= 10) {
+    YAML::Node sceneNode = generateScene(count);
+    std::vector<float> staging(20 * count);
+    CompiledScene scene;
+    double compile = millisecondsPerFrame([&]() { scene = compileScene(sceneNode); });
+    double yaml = millisecondsPerFrame([&]() { frameFromYaml(sceneNode, staging.data()); });
+    double compiled = millisecondsPerFrame([&]() { frameFromCompiled(scene, staging.data()); });
+    std::printf("%10zu %14.3f %14.3f %14.4f\n", count, compile, yaml, compiled);
+  }
+
+  const size_t assemblies = 100, parts = 1000;
+  SceneGraph graph;
+  std::vector<SceneGraph::Node> roots;
+  for (size_t i = 0; i < assemblies; i++) {
+    roots.push_back(graph.add(SceneGraph::NONE, geom::translate((float) i, 0.0f, 0.0f)));
+    for (size_t j = 0; j < parts; j++) {
+      graph.add(roots.back(), geom::translate(0.0f, (float) j, 0.0f));
+    }
+  }
+  graph.update();
+  std::printf("\n%10s %14s %14s %14s\n", "moved", "full [ms/f]", "incr. [ms/f]", "nodes updated");
+  for (size_t moved = 1; moved <= assemblies; moved *= 10) {
+    float angle = 0.0f;
+    double full = millisecondsPerFrame([&]() {
+      angle += 0.01f;
+      for (size_t i = 0; i < assemblies; i++) {
+        graph.setLocal(roots[i], geom::translate((float) i, 0.0f, 0.0f) * geom::rotateZ(angle));
+      }
+      graph.update();
+    });
+    double incremental = millisecondsPerFrame([&]() {
+      angle += 0.01f;
+      for (size_t i = 0; i < moved; i++) {
+        graph.setLocal(roots[i], geom::translate((float) i, 0.0f, 0.0f) * geom::rotateZ(angle));
+      }
+      graph.update();
+    });
+    std::printf("%10zu %14.3f %14.3f %14zu\n", moved, full, incremental, graph.updatedCount());
+  }
+  return 0;
+}
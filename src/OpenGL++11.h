@@ -7,9 +7,29 @@
 #define OPENGL11_H
 #include <array>
 #include <vector>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <map>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 #include <GLXW/glxw.h>
 #include <GL/gl.h>
 #include <lodepng.h>
@@ -24,7 +44,21 @@
 #include <boost/multi_array.h>
 #endif
 
+/*
+ * error checking:
+ *   default                  glGetError() after every call
+ *   enableDebugOutput()      (at runtime) errors are reported by a KHR_debug callback, no glGetError() unless one occurred
+ *   OPENGL11_NO_ERROR_CHECK  (or NDEBUG without OPENGL11_ERROR_CHECK) compiled out
+ */
+#if defined(NDEBUG) && !defined(OPENGL11_ERROR_CHECK) && !defined(OPENGL11_NO_ERROR_CHECK)
+#define OPENGL11_NO_ERROR_CHECK
+#endif
+
+#ifdef OPENGL11_NO_ERROR_CHECK
+#define GL_CHECK_ERROR() ((void) 0)
+#else
 #define GL_CHECK_ERROR() OpenGL11::throwOnGLError(__FILE__, __LINE__)
+#endif
 
 namespace OpenGL11 {
 
@@ -42,7 +76,8 @@ typedef arma::ivec::fixed<3> ivec3;
 typedef arma::ivec::fixed<4> ivec4;
 #endif
 
-inline void throwGLError(const std::string filename, const int line, GLenum err) {
+/* detail: the KHR_debug message of the error, if any */
+inline void throwGLError(const std::string filename, const int line, GLenum err, const std::string &detail = "") {
     std::stringstream s_error;
     s_error << filename << ":" << line << ": OpenGL Error (";
     switch(err) {
@@ -87,17 +122,826 @@ inline void throwGLError(const std::string filename, const int line, GLenum err)
      default:
       s_error << "error code " << err ; 
     }
+    if (!detail.empty()) {
+      s_error << ": " << detail;
+    }
     s_error << ")";
     throw std::logic_error(s_error.str());
 }
 
-inline void throwOnGLError(const std::string filename, const int line) {
+/* error reported by the debug output callback, waiting for the next GL_CHECK_ERROR() */
+struct DebugOutputState {
+  bool enabled, pending;
+  std::string message;
+};
+
+inline DebugOutputState& debugOutputState() {
+  static thread_local DebugOutputState state = { false, false, "" };
+  return state;
+}
+
+inline void throwOnGLError(const char *filename, const int line) {
+  DebugOutputState &debug = debugOutputState();
+  if (debug.enabled) {
+    if (!debug.pending) {
+      return;
+    }
+    debug.pending = false;
+  }
   GLenum err(glGetError());
+  if (err == GL_NO_ERROR && debug.enabled) {
+    std::stringstream s_error;
+    s_error << filename << ":" << line << ": OpenGL Error (" << debug.message << ")";
+    throw std::logic_error(s_error.str());
+  }
   while (err!=GL_NO_ERROR) {
-    throwGLError(filename, line, err);
+    throwGLError(filename, line, err, debug.enabled ? debug.message : "");
+  }
+}
+
+inline bool hasExtension(const char *name) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (GLint i = 0; i < count; i++) {
+    if (std::string((const char *) glGetStringi(GL_EXTENSIONS, i)) == name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+inline bool hasVersion(int major, int minor) {
+  GLint ctxMajor = 0, ctxMinor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &ctxMajor);
+  glGetIntegerv(GL_MINOR_VERSION, &ctxMinor);
+  return ctxMajor > major || (ctxMajor == major && ctxMinor >= minor);
+}
+
+inline void APIENTRY debugOutputCallback(GLenum, GLenum type, GLuint, GLenum,
+                                         GLsizei length, const GLchar *message, const void *) {
+  if (type != GL_DEBUG_TYPE_ERROR) {
+    return;
+  }
+  // do not throw across the driver; GL_CHECK_ERROR() throws when the call returns
+  DebugOutputState &debug = debugOutputState();
+  debug.pending = true;
+  debug.message.assign(message, length < 0 ? strlen(message) : length);
+}
+
+/*
+ * switch GL_CHECK_ERROR() to KHR_debug error reporting on the current context.
+ * returns false (and keeps using glGetError) when the context has no KHR_debug.
+ * some drivers only report errors on a debug context (QSurfaceFormat::DebugContext).
+ */
+inline bool enableDebugOutput() {
+  if (!hasVersion(4, 3) && !hasExtension("GL_KHR_debug")) {
+    return false;
+  }
+  // errors raised before this point are still reported by glGetError
+  GL_CHECK_ERROR();
+  glEnable(GL_DEBUG_OUTPUT);
+  glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+  glDebugMessageCallback(debugOutputCallback, NULL);
+  glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_FALSE);
+  glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_ERROR, GL_DONT_CARE, 0, NULL, GL_TRUE);
+  GL_CHECK_ERROR();
+  DebugOutputState &debug = debugOutputState();
+  debug.enabled = true;
+  debug.pending = false;
+  return true;
+}
+
+inline void disableDebugOutput() {
+  DebugOutputState &debug = debugOutputState();
+  if (!debug.enabled) {
+    return;
+  }
+  glDebugMessageCallback(NULL, NULL);
+  glDisable(GL_DEBUG_OUTPUT);
+  debug.enabled = false;
+  debug.pending = false;
+}
+
+inline GLsizei sizeOfDataType(GLenum dataType) {
+  switch (dataType) {
+    case GL_BYTE:
+    case GL_UNSIGNED_BYTE:
+      return 1;
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+      return 2;
+    case GL_DOUBLE:
+      return 8;
+  }
+  return 4;
+}
+
+/* number of columns (= attribute locations) of a matrix type, 1 for the others */
+inline GLint columnsOfType(GLenum type) {
+  switch (type) {
+    case GL_FLOAT_MAT2:
+    case GL_FLOAT_MAT2x3:
+    case GL_FLOAT_MAT2x4:
+    case GL_DOUBLE_MAT2:
+    case GL_DOUBLE_MAT2x3:
+    case GL_DOUBLE_MAT2x4:
+      return 2;
+    case GL_FLOAT_MAT3:
+    case GL_FLOAT_MAT3x2:
+    case GL_FLOAT_MAT3x4:
+    case GL_DOUBLE_MAT3:
+    case GL_DOUBLE_MAT3x2:
+    case GL_DOUBLE_MAT3x4:
+      return 3;
+    case GL_FLOAT_MAT4:
+    case GL_FLOAT_MAT4x2:
+    case GL_FLOAT_MAT4x3:
+    case GL_DOUBLE_MAT4:
+    case GL_DOUBLE_MAT4x2:
+    case GL_DOUBLE_MAT4x3:
+      return 4;
   }
+  return 1;
 }
 
+/* FNV-1a hash of a uniform/attribute name (constexpr so that literals can be hashed at compile time) */
+constexpr uint32_t hashName(const char *s, uint32_t h = 2166136261u) {
+  return *s ? hashName(s + 1, (h ^ (uint8_t) *s) * 16777619u) : h;
+}
+
+/*
+ * name of a uniform or an attribute with its precomputed hash.
+ * string literals convert implicitly; declare it constexpr to force the hashing at compile time:
+ *   constexpr OpenGL11::Name proj("proj");
+ */
+struct Name {
+  const char *str;
+  uint32_t hash;
+  constexpr Name(const char *a_str) : str(a_str), hash(hashName(a_str)) {};
+  Name(const std::string &a_str) : str(a_str.c_str()), hash(hashName(a_str.c_str())) {};
+};
+
+/* object types whose names come from a HandlePool */
+enum HandleType {
+  BUFFER_HANDLE,
+  TEXTURE_HANDLE,
+  SAMPLER_HANDLE,
+  FRAMEBUFFER_HANDLE,
+  RENDERBUFFER_HANDLE,
+  VERTEX_ARRAY_HANDLE,
+  HANDLE_TYPES
+};
+
+/*
+ * names of one object type, generated in blocks and deleted in batches:
+ * allocate() hands out pre-generated names (one glGen* call per block; blocks grow from 16 to 1024 names),
+ * release() queues a name and flush() deletes the whole queue with one glDelete* call.
+ * released names do not go back to the free list: reusing one without glDelete* would keep the
+ * storage and state of the old object, and a core profile only binds names that glGen* returned.
+ * the driver may hand them out again from a later glGen* call.
+ * programs and shaders have no batched entry points and are not pooled.
+ */
+class HandlePool {
+  public:
+    struct Statistics {
+      // names handed out, pre-generated, waiting for flush()
+      size_t live, free, pending;
+      unsigned long genCalls, deleteCalls;
+    };
+    enum { MIN_BLOCK = 16, MAX_BLOCK = 1024, MAX_PENDING = 1024 };
+  private:
+    HandleType _type;
+    std::vector<GLuint> _free, _pending;
+    GLsizei _blockSize;
+    Statistics _statistics;
+    void generate(GLsizei n, GLuint *names) {
+      switch (_type) {
+        case BUFFER_HANDLE:       glGenBuffers(n, names); break;
+        case TEXTURE_HANDLE:      glGenTextures(n, names); break;
+        case SAMPLER_HANDLE:      glGenSamplers(n, names); break;
+        case FRAMEBUFFER_HANDLE:  glGenFramebuffers(n, names); break;
+        case RENDERBUFFER_HANDLE: glGenRenderbuffers(n, names); break;
+        case VERTEX_ARRAY_HANDLE: glGenVertexArrays(n, names); break;
+        default: throw std::logic_error("HandlePool: unknown handle type");
+      }
+      GL_CHECK_ERROR();
+      _statistics.genCalls++;
+    };
+    void destroy(GLsizei n, const GLuint *names) {
+      if (!n) {
+        return;
+      }
+      switch (_type) {
+        case BUFFER_HANDLE:       glDeleteBuffers(n, names); break;
+        case TEXTURE_HANDLE:      glDeleteTextures(n, names); break;
+        case SAMPLER_HANDLE:      glDeleteSamplers(n, names); break;
+        case FRAMEBUFFER_HANDLE:  glDeleteFramebuffers(n, names); break;
+        case RENDERBUFFER_HANDLE: glDeleteRenderbuffers(n, names); break;
+        case VERTEX_ARRAY_HANDLE: glDeleteVertexArrays(n, names); break;
+        default: throw std::logic_error("HandlePool: unknown handle type");
+      }
+      GL_CHECK_ERROR();
+      _statistics.deleteCalls++;
+    };
+  public:
+    HandlePool(HandleType type = BUFFER_HANDLE) : _type(type), _blockSize(MIN_BLOCK) {
+      _statistics.live = _statistics.free = _statistics.pending = 0;
+      _statistics.genCalls = _statistics.deleteCalls = 0;
+    };
+    GLuint allocate() {
+      if (_free.empty()) {
+        _free.resize(_blockSize);
+        generate(_blockSize, _free.data());
+        // hand out the names in the order GL generated them
+        std::reverse(_free.begin(), _free.end());
+        _blockSize = std::min<GLsizei>(2 * _blockSize, MAX_BLOCK);
+      }
+      GLuint id = _free.back();
+      _free.pop_back();
+      _statistics.live++;
+      _statistics.free = _free.size();
+      return id;
+    };
+    /* queue the name for the next flush(); the object stays alive until then */
+    void release(GLuint id) {
+      _pending.push_back(id);
+      _statistics.live--;
+      _statistics.pending = _pending.size();
+      if (_pending.size() >= MAX_PENDING) {
+        flush();
+      }
+    };
+    void flush() {
+      destroy((GLsizei) _pending.size(), _pending.data());
+      _pending.clear();
+      _statistics.pending = 0;
+    };
+    /* also delete the pre-generated names that were never handed out */
+    void trim() {
+      flush();
+      destroy((GLsizei) _free.size(), _free.data());
+      _free.clear();
+      _statistics.free = 0;
+      _blockSize = MIN_BLOCK;
+    };
+    const Statistics& statistics() const {
+      return _statistics;
+    };
+};
+
+/*
+ * shadow copy of the binding state of one OpenGL context.
+ *
+ * The wrappers below go through StateCache::current() instead of calling glBind* / glUseProgram /
+ * glEnable directly, so that calls which would not change anything are skipped.
+ * Everything starts as "unknown" and the first call is always issued;
+ * call invalidate() after changing the state without going through this class.
+ *
+ * Object names are also allocated here, from one HandlePool per type. delete*() unbinds the object
+ * where the cache knows it is bound and queues the name; flush() (once per frame) deletes the queues.
+ */
+class StateCache {
+  public:
+    struct Statistics {
+      unsigned long issued, elided;
+    };
+  private:
+    enum : GLuint { UNKNOWN = 0xFFFFFFFFu };
+    /* vertex attribute setup of one attribute index, which is a part of the VAO state */
+    struct VertexAttrib {
+      bool enabled, pointerSet, divisorSet;
+      GLuint buffer;
+      GLint size;
+      GLenum type;
+      GLboolean normalized;
+      GLsizei stride;
+      intptr_t offset;
+      GLuint divisor;
+    };
+    /* glBindBufferBase (size < 0) or glBindBufferRange */
+    struct IndexedBuffer {
+      GLuint buffer;
+      GLintptr offset;
+      GLsizeiptr size;
+    };
+    GLuint _program, _vertexArray, _activeTexture, _drawFramebuffer, _readFramebuffer, _renderbuffer;
+    GLint _maxTextureImageUnits, _maxVertexAttribs;
+    int _textureStorage, _parallelShaderCompile;
+    std::unordered_map<GLenum, GLuint> _buffers;
+    std::unordered_map<uint64_t, IndexedBuffer> _indexedBuffers;
+    std::unordered_map<uint64_t, GLuint> _textures;
+    std::unordered_map<GLuint, GLuint> _samplers;
+    std::unordered_map<GLenum, bool> _capabilities;
+    std::unordered_map<GLuint, std::vector<VertexAttrib> > _vertexAttribs;
+    Statistics _statistics;
+    HandlePool _handles[HANDLE_TYPES];
+
+    static StateCache& threadDefault() {
+      static thread_local StateCache cache;
+      return cache;
+    };
+    static StateCache*& currentPointer() {
+      static thread_local StateCache *pointer = &threadDefault();
+      return pointer;
+    };
+    bool update(GLuint &current, GLuint id) {
+      if (current == id) {
+        _statistics.elided++;
+        return false;
+      }
+      current = id;
+      _statistics.issued++;
+      return true;
+    };
+    GLuint& buffer(GLenum target) {
+      std::unordered_map<GLenum, GLuint>::iterator it = _buffers.find(target);
+      if (it == _buffers.end()) {
+        it = _buffers.insert(std::make_pair(target, (GLuint) UNKNOWN)).first;
+      }
+      return it->second;
+    };
+    GLuint& texture(GLenum target) {
+      if (_activeTexture == UNKNOWN) {
+        GLint unit;
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+        GL_CHECK_ERROR();
+        _activeTexture = unit;
+      }
+      uint64_t key = ((uint64_t) _activeTexture << 32) | target;
+      std::unordered_map<uint64_t, GLuint>::iterator it = _textures.find(key);
+      if (it == _textures.end()) {
+        it = _textures.insert(std::make_pair(key, (GLuint) UNKNOWN)).first;
+      }
+      return it->second;
+    };
+    /* attribute state of the bound VAO, NULL if it is unknown or index is out of range */
+    VertexAttrib* vertexAttrib(GLuint index) {
+      if (_vertexArray == UNKNOWN || index >= (GLuint) maxVertexAttribs()) {
+        return NULL;
+      }
+      std::vector<VertexAttrib> &attribs = _vertexAttribs[_vertexArray];
+      if (index >= attribs.size()) {
+        attribs.resize(index + 1, VertexAttrib { false, false, false, 0, 0, 0, GL_FALSE, 0, 0, 0 });
+      }
+      return &attribs[index];
+    };
+    static GLuint known(GLuint id) {
+      return (id == UNKNOWN) ? 0 : id;
+    };
+  public:
+    StateCache() {
+      for (int i = 0; i < HANDLE_TYPES; i++) {
+        _handles[i] = HandlePool((HandleType) i);
+      }
+      invalidate();
+      resetStatistics();
+    };
+    /* the cache of the context current on this thread */
+    static StateCache& current() {
+      return *currentPointer();
+    };
+    /* switch caches together with the context; pass NULL to get back to the per-thread default */
+    static void makeCurrent(StateCache *cache) {
+      currentPointer() = cache ? cache : &threadDefault();
+    };
+    void invalidate() {
+      _program = _vertexArray = _activeTexture = _drawFramebuffer = _readFramebuffer = _renderbuffer = UNKNOWN;
+      _maxTextureImageUnits = _maxVertexAttribs = 0;
+      _textureStorage = _parallelShaderCompile = -1;
+      _buffers.clear();
+      _indexedBuffers.clear();
+      _textures.clear();
+      _samplers.clear();
+      _capabilities.clear();
+      _vertexAttribs.clear();
+    };
+    const Statistics& statistics() const {
+      return _statistics;
+    };
+    void resetStatistics() {
+      _statistics.issued = _statistics.elided = 0;
+    };
+
+    /* a new name of the type, from the pool */
+    GLuint generate(HandleType type) {
+      return _handles[type].allocate();
+    };
+    const HandlePool::Statistics& handleStatistics(HandleType type) const {
+      return _handles[type].statistics();
+    };
+    /* delete the names queued by delete*() */
+    void flush() {
+      for (int i = 0; i < HANDLE_TYPES; i++) {
+        _handles[i].flush();
+      }
+    };
+    /* flush() and delete the unused pre-generated names */
+    void trim() {
+      for (int i = 0; i < HANDLE_TYPES; i++) {
+        _handles[i].trim();
+      }
+    };
+
+    /* currently bound names (0 when unknown) */
+    GLuint boundProgram() const {
+      return known(_program);
+    };
+    GLuint boundVertexArray() const {
+      return known(_vertexArray);
+    };
+    GLuint boundBuffer(GLenum target) {
+      return known(buffer(target));
+    };
+    GLuint boundTexture(GLenum target) {
+      return known(texture(target));
+    };
+    GLuint boundFramebuffer(GLenum target) const {
+      return known(target == GL_READ_FRAMEBUFFER ? _readFramebuffer : _drawFramebuffer);
+    };
+    GLuint boundRenderbuffer() const {
+      return known(_renderbuffer);
+    };
+    GLint maxTextureImageUnits() {
+      if (!_maxTextureImageUnits) {
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &_maxTextureImageUnits);
+        GL_CHECK_ERROR();
+      }
+      return _maxTextureImageUnits;
+    };
+    GLint maxVertexAttribs() {
+      if (!_maxVertexAttribs) {
+        glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &_maxVertexAttribs);
+        GL_CHECK_ERROR();
+      }
+      return _maxVertexAttribs;
+    };
+    /* glTexStorage*: GL 4.2 or ARB_texture_storage */
+    bool hasTextureStorage() {
+      if (_textureStorage < 0) {
+        _textureStorage = hasVersion(4, 2) || hasExtension("GL_ARB_texture_storage");
+      }
+      return _textureStorage;
+    };
+    /* GL_COMPLETION_STATUS_KHR: KHR_parallel_shader_compile or ARB_parallel_shader_compile */
+    bool hasParallelShaderCompile() {
+      if (_parallelShaderCompile < 0) {
+        _parallelShaderCompile = hasExtension("GL_KHR_parallel_shader_compile") || hasExtension("GL_ARB_parallel_shader_compile");
+      }
+      return _parallelShaderCompile;
+    };
+
+    void useProgram(GLuint id) {
+      if (update(_program, id)) {
+        glUseProgram(id);
+        GL_CHECK_ERROR();
+      }
+    };
+    void bindVertexArray(GLuint id) {
+      if (update(_vertexArray, id)) {
+        glBindVertexArray(id);
+        GL_CHECK_ERROR();
+        // the element array binding is a part of the VAO
+        buffer(GL_ELEMENT_ARRAY_BUFFER) = UNKNOWN;
+      }
+    };
+    void bindBuffer(GLenum target, GLuint id) {
+      if (update(buffer(target), id)) {
+        glBindBuffer(target, id);
+        GL_CHECK_ERROR();
+      }
+    };
+    /* indexed bindings also replace the generic binding of the target */
+    void bindBufferRange(GLenum target, GLuint index, GLuint id, GLintptr offset, GLsizeiptr size) {
+      uint64_t key = ((uint64_t) target << 32) | index;
+      std::unordered_map<uint64_t, IndexedBuffer>::iterator it = _indexedBuffers.find(key);
+      if (it != _indexedBuffers.end() && it->second.buffer == id && it->second.offset == offset && it->second.size == size) {
+        _statistics.elided++;
+        return;
+      }
+      _indexedBuffers[key] = IndexedBuffer { id, offset, size };
+      buffer(target) = id;
+      _statistics.issued++;
+      if (size < 0) {
+        glBindBufferBase(target, index, id);
+      } else {
+        glBindBufferRange(target, index, id, offset, size);
+      }
+      GL_CHECK_ERROR();
+    };
+    void bindBufferBase(GLenum target, GLuint index, GLuint id) {
+      bindBufferRange(target, index, id, 0, -1);
+    };
+    /* texture: GL_TEXTURE0 + i */
+    void activeTexture(GLenum texture) {
+      if (update(_activeTexture, texture)) {
+        glActiveTexture(texture);
+        GL_CHECK_ERROR();
+      }
+    };
+    /* bind to the active texture unit */
+    void bindTexture(GLenum target, GLuint id) {
+      if (update(texture(target), id)) {
+        glBindTexture(target, id);
+        GL_CHECK_ERROR();
+      }
+    };
+    /* unit: 0 .. maxTextureImageUnits() - 1; 0 unbinds the sampler, the texture parameters apply again */
+    void bindSampler(GLuint unit, GLuint id) {
+      std::unordered_map<GLuint, GLuint>::iterator it = _samplers.find(unit);
+      if (it == _samplers.end()) {
+        it = _samplers.insert(std::make_pair(unit, (GLuint) UNKNOWN)).first;
+      }
+      if (update(it->second, id)) {
+        glBindSampler(unit, id);
+        GL_CHECK_ERROR();
+      }
+    };
+    void bindFramebuffer(GLenum target, GLuint id) {
+      if (target == GL_FRAMEBUFFER) {
+        if (_drawFramebuffer == id && _readFramebuffer == id) {
+          _statistics.elided++;
+          return;
+        }
+        _drawFramebuffer = _readFramebuffer = id;
+        _statistics.issued++;
+      } else if (!update(target == GL_READ_FRAMEBUFFER ? _readFramebuffer : _drawFramebuffer, id)) {
+        return;
+      }
+      glBindFramebuffer(target, id);
+      GL_CHECK_ERROR();
+    };
+    void bindRenderbuffer(GLuint id) {
+      if (update(_renderbuffer, id)) {
+        glBindRenderbuffer(GL_RENDERBUFFER, id);
+        GL_CHECK_ERROR();
+      }
+    };
+    void setCapability(GLenum cap, bool enabled) {
+      std::unordered_map<GLenum, bool>::iterator it = _capabilities.find(cap);
+      if (it != _capabilities.end() && it->second == enabled) {
+        _statistics.elided++;
+        return;
+      }
+      _capabilities[cap] = enabled;
+      _statistics.issued++;
+      if (enabled) {
+        glEnable(cap);
+      } else {
+        glDisable(cap);
+      }
+      GL_CHECK_ERROR();
+    };
+    void enable(GLenum cap) {
+      setCapability(cap, true);
+    };
+    void disable(GLenum cap) {
+      setCapability(cap, false);
+    };
+    void enableVertexAttribArray(GLuint index) {
+      VertexAttrib *attrib = vertexAttrib(index);
+      if (attrib && attrib->enabled) {
+        _statistics.elided++;
+        return;
+      }
+      _statistics.issued++;
+      glEnableVertexAttribArray(index);
+      GL_CHECK_ERROR();
+      if (attrib) {
+        attrib->enabled = true;
+      }
+    };
+    /* source buffer is the one bound to GL_ARRAY_BUFFER */
+    void vertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, intptr_t offset) {
+      VertexAttrib *attrib = vertexAttrib(index);
+      GLuint arrayBuffer = buffer(GL_ARRAY_BUFFER);
+      if (attrib && attrib->pointerSet && arrayBuffer != UNKNOWN && attrib->buffer == arrayBuffer
+          && attrib->size == size && attrib->type == type && attrib->normalized == normalized
+          && attrib->stride == stride && attrib->offset == offset) {
+        _statistics.elided++;
+        return;
+      }
+      _statistics.issued++;
+      glVertexAttribPointer(index, size, type, normalized, stride, (GLvoid *) offset);
+      GL_CHECK_ERROR();
+      if (attrib) {
+        attrib->pointerSet = (arrayBuffer != UNKNOWN);
+        attrib->buffer = arrayBuffer;
+        attrib->size = size;
+        attrib->type = type;
+        attrib->normalized = normalized;
+        attrib->stride = stride;
+        attrib->offset = offset;
+      }
+    };
+    /* 0: per vertex, n: advance once per n instances */
+    void vertexAttribDivisor(GLuint index, GLuint divisor) {
+      VertexAttrib *attrib = vertexAttrib(index);
+      if (attrib && attrib->divisorSet && attrib->divisor == divisor) {
+        _statistics.elided++;
+        return;
+      }
+      _statistics.issued++;
+      glVertexAttribDivisor(index, divisor);
+      GL_CHECK_ERROR();
+      if (attrib) {
+        attrib->divisorSet = true;
+        attrib->divisor = divisor;
+      }
+    };
+
+    /*
+     * deleting a bound object resets the binding to 0. the names are deleted by flush(), so an object
+     * bound behind the back of the cache stays alive (and bound) until then.
+     */
+    void deleteProgram(GLuint id) {
+      if (!id) {
+        return;
+      }
+      glDeleteProgram(id);
+      GL_CHECK_ERROR();
+      if (_program == id) {
+        // stays in use until another program is bound
+        _program = UNKNOWN;
+      }
+    };
+    void deleteVertexArray(GLuint id) {
+      if (!id) {
+        return;
+      }
+      if (_vertexArray == id) {
+        bindVertexArray(0);
+      }
+      _vertexAttribs.erase(id);
+      _handles[VERTEX_ARRAY_HANDLE].release(id);
+    };
+    void deleteBuffer(GLuint id) {
+      if (!id) {
+        return;
+      }
+      for (std::unordered_map<GLenum, GLuint>::iterator it = _buffers.begin(); it != _buffers.end(); ++it) {
+        if (it->second == id) {
+          bindBuffer(it->first, 0);
+        }
+      }
+      for (std::unordered_map<uint64_t, IndexedBuffer>::iterator it = _indexedBuffers.begin(); it != _indexedBuffers.end(); ) {
+        if (it->second.buffer == id) {
+          it = _indexedBuffers.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      // the name may be reused by a new buffer that VAOs do not refer to
+      for (std::unordered_map<GLuint, std::vector<VertexAttrib> >::iterator it = _vertexAttribs.begin(); it != _vertexAttribs.end(); ++it) {
+        for (size_t i = 0; i < it->second.size(); i++) {
+          if (it->second[i].buffer == id) {
+            it->second[i].pointerSet = false;
+          }
+        }
+      }
+      _handles[BUFFER_HANDLE].release(id);
+    };
+    void deleteTexture(GLuint id) {
+      if (!id) {
+        return;
+      }
+      GLuint active = _activeTexture;
+      for (std::unordered_map<uint64_t, GLuint>::iterator it = _textures.begin(); it != _textures.end(); ++it) {
+        if (it->second == id) {
+          activeTexture((GLenum) (it->first >> 32));
+          bindTexture((GLenum) (it->first & 0xFFFFFFFFu), 0);
+        }
+      }
+      if (active != UNKNOWN) {
+        activeTexture(active);
+      }
+      _handles[TEXTURE_HANDLE].release(id);
+    };
+    void deleteSampler(GLuint id) {
+      if (!id) {
+        return;
+      }
+      for (std::unordered_map<GLuint, GLuint>::iterator it = _samplers.begin(); it != _samplers.end(); ++it) {
+        if (it->second == id) {
+          bindSampler(it->first, 0);
+        }
+      }
+      _handles[SAMPLER_HANDLE].release(id);
+    };
+    void deleteFramebuffer(GLuint id) {
+      if (!id) {
+        return;
+      }
+      if (_drawFramebuffer == id && _readFramebuffer == id) {
+        bindFramebuffer(GL_FRAMEBUFFER, 0);
+      } else if (_drawFramebuffer == id) {
+        bindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+      } else if (_readFramebuffer == id) {
+        bindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+      }
+      _handles[FRAMEBUFFER_HANDLE].release(id);
+    };
+    void deleteRenderbuffer(GLuint id) {
+      if (!id) {
+        return;
+      }
+      if (_renderbuffer == id) {
+        bindRenderbuffer(0);
+      }
+      _handles[RENDERBUFFER_HANDLE].release(id);
+    };
+};
+
+/* non-owning view of `size` contiguous elements */
+template <typename T> class Span {
+  private:
+    T *_data;
+    size_t _size;
+  public:
+    Span() : _data(NULL), _size(0) {};
+    Span(T *a_data, size_t a_size) : _data(a_data), _size(a_size) {};
+    /* view of a container with data() and size(): std::vector, std::array, Span */
+    template <typename C>
+      Span(C &container) : _data(container.data()), _size(container.size()) {};
+    T* data() const {
+      return _data;
+    };
+    size_t size() const {
+      return _size;
+    };
+    T* begin() const {
+      return _data;
+    };
+    T* end() const {
+      return _data + _size;
+    };
+    T& operator[](size_t i) const {
+      return _data[i];
+    };
+};
+
+/* one fence per region of a ring buffer, so that a region is rewritten only after the GPU is done with it */
+class FrameFences {
+  private:
+    std::vector<GLsync> _fences;
+  public:
+    FrameFences(int frames = 0) : _fences(frames, (GLsync) 0) {};
+    FrameFences(const FrameFences&) = delete;
+    FrameFences& operator=(const FrameFences&) = delete;
+    FrameFences(FrameFences &&other) : _fences(std::move(other._fences)) {
+      other._fences.clear();
+    };
+    FrameFences& operator=(FrameFences &&other) {
+      if (this != &other) {
+        for (size_t i = 0; i < _fences.size(); i++) {
+          if (_fences[i]) {
+            glDeleteSync(_fences[i]);
+          }
+        }
+        _fences = std::move(other._fences);
+        other._fences.clear();
+      }
+      return *this;
+    };
+    ~FrameFences() {
+      for (size_t i = 0; i < _fences.size(); i++) {
+        if (_fences[i]) {
+          glDeleteSync(_fences[i]);
+        }
+      }
+    };
+    int size() const {
+      return (int) _fences.size();
+    };
+    void resize(int frames) {
+      waitAll();
+      _fences.assign(frames, (GLsync) 0);
+    };
+    /* block until the commands issued before fence(frame) are complete */
+    void wait(int frame) {
+      GLsync &fence = _fences[frame];
+      if (!fence) {
+        return;
+      }
+      while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+      glDeleteSync(fence);
+      GL_CHECK_ERROR();
+      fence = 0;
+    };
+    void waitAll() {
+      for (int i = 0; i < size(); i++) {
+        wait(i);
+      }
+    };
+    void fence(int frame) {
+      if (_fences[frame]) {
+        glDeleteSync(_fences[frame]);
+      }
+      _fences[frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      GL_CHECK_ERROR();
+    };
+};
+
 class Renderbuffer {
   private:
     GLuint _id;
@@ -110,6 +954,24 @@ class Renderbuffer {
     ~Renderbuffer() {
       release();
     };
+    /*
+     * the GL wrappers are move-only: a copy would release the name twice. The name moves and the
+     * source is left empty, so its destructor releases nothing
+     */
+    Renderbuffer(const Renderbuffer&) = delete;
+    Renderbuffer& operator=(const Renderbuffer&) = delete;
+    Renderbuffer(Renderbuffer &&other) : _id(other._id), _internalFormat(other._internalFormat) {
+      other._id = 0;
+    };
+    Renderbuffer& operator=(Renderbuffer &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        _internalFormat = other._internalFormat;
+        other._id = 0;
+      }
+      return *this;
+    };
     GLuint id() const {
       return _id;
     };
@@ -117,116 +979,396 @@ class Renderbuffer {
       return (_id != 0);
     };
     void create() {
-      glGenRenderbuffers(1, &_id);
+      _id = StateCache::current().generate(RENDERBUFFER_HANDLE);
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteRenderbuffers(1, &_id);
-      GL_CHECK_ERROR();
+      StateCache::current().deleteRenderbuffer(_id);
     };
     void bind() {
-      glBindRenderbuffer(GL_RENDERBUFFER, _id);
-      GL_CHECK_ERROR();
+      StateCache::current().bindRenderbuffer(_id);
     };
     void unbind() const {
-      glBindRenderbuffer(GL_RENDERBUFFER, 0);
-      GL_CHECK_ERROR();
+      StateCache::current().bindRenderbuffer(0);
     };
     void allocate(int w, int h) {
       if(!isCreated()) {
         create();
       }
+      GLuint previous = StateCache::current().boundRenderbuffer();
       bind();
       glRenderbufferStorage(GL_RENDERBUFFER, _internalFormat, w, h);
       GL_CHECK_ERROR();
-      unbind();
+      StateCache::current().bindRenderbuffer(previous);
     };
 };
 
+/*
+ * image files, always 8 bit RGBA in memory:
+ *   .qoi  "Quite OK Image" format (https://qoiformat.org): lossless, encodes and decodes several times faster than PNG
+ *   other PNG through lodepng; compression 0 (stored) .. 9 (best), 6 by default
+ * readImage() and writeImage() throw std::runtime_error and may run on any thread.
+ */
+struct Image {
+  unsigned int width, height;
+  std::vector<uint8_t> pixels;
+  Image() : width(0), height(0) {};
+  Image(unsigned int w, unsigned int h) : width(w), height(h), pixels(w * h * 4) {};
+};
+
+inline bool isQOIFile(const std::string &filename) {
+  return filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".qoi") == 0;
+}
+
+inline uint32_t qoiHash(const uint8_t *px) {
+  return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+}
+
+inline void encodeQOI(const Image &image, std::vector<uint8_t> &out) {
+  enum { OP_INDEX = 0x00, OP_DIFF = 0x40, OP_LUMA = 0x80, OP_RUN = 0xc0, OP_RGB = 0xfe, OP_RGBA = 0xff };
+  out.clear();
+  out.reserve(22 + image.pixels.size() / 2);
+  const uint8_t magic[4] = {'q', 'o', 'i', 'f'};
+  out.insert(out.end(), magic, magic + 4);
+  for (int shift = 24; shift >= 0; shift -= 8) out.push_back(image.width >> shift);
+  for (int shift = 24; shift >= 0; shift -= 8) out.push_back(image.height >> shift);
+  out.push_back(4); // channels
+  out.push_back(0); // sRGB with linear alpha
+  uint8_t index[64][4] = {};
+  uint8_t previous[4] = {0, 0, 0, 255};
+  int run = 0;
+  const uint8_t *end = image.pixels.data() + image.pixels.size();
+  for (const uint8_t *px = image.pixels.data(); px < end; px += 4) {
+    if (!memcmp(px, previous, 4)) {
+      if (++run == 62 || px + 4 == end) {
+        out.push_back(OP_RUN | (run - 1));
+        run = 0;
+      }
+      continue;
+    }
+    if (run) {
+      out.push_back(OP_RUN | (run - 1));
+      run = 0;
+    }
+    uint32_t h = qoiHash(px);
+    if (!memcmp(index[h], px, 4)) {
+      out.push_back(OP_INDEX | h);
+    } else {
+      memcpy(index[h], px, 4);
+      if (px[3] == previous[3]) {
+        int8_t dr = px[0] - previous[0], dg = px[1] - previous[1], db = px[2] - previous[2];
+        int8_t dr_dg = dr - dg, db_dg = db - dg;
+        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+          out.push_back(OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+        } else if (dr_dg >= -8 && dr_dg <= 7 && dg >= -32 && dg <= 31 && db_dg >= -8 && db_dg <= 7) {
+          out.push_back(OP_LUMA | (dg + 32));
+          out.push_back((dr_dg + 8) << 4 | (db_dg + 8));
+        } else {
+          out.push_back(OP_RGB);
+          out.insert(out.end(), px, px + 3);
+        }
+      } else {
+        out.push_back(OP_RGBA);
+        out.insert(out.end(), px, px + 4);
+      }
+    }
+    memcpy(previous, px, 4);
+  }
+  const uint8_t padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+  out.insert(out.end(), padding, padding + 8);
+}
+
+inline void decodeQOI(const std::vector<uint8_t> &in, Image &image) {
+  enum { OP_INDEX = 0x00, OP_DIFF = 0x40, OP_LUMA = 0x80, OP_RUN = 0xc0, OP_RGB = 0xfe, OP_RGBA = 0xff };
+  if (in.size() < 22 || memcmp(in.data(), "qoif", 4)) {
+    throw std::runtime_error("decodeQOI: not a QOI image");
+  }
+  const uint8_t *p = in.data() + 4, *end = in.data() + in.size() - 8;
+  uint32_t w = (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+  uint32_t h = (uint32_t) p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+  if (!w || !h || (uint64_t) w * h > 400000000) {
+    throw std::runtime_error("decodeQOI: invalid image size");
+  }
+  p += 10;
+  image = Image(w, h);
+  uint8_t index[64][4] = {};
+  uint8_t px[4] = {0, 0, 0, 255};
+  int run = 0;
+  for (uint8_t *out = image.pixels.data(), *last = out + image.pixels.size(); out < last; out += 4) {
+    if (run) {
+      run--;
+    } else if (p < end) {
+      uint8_t b = *p++;
+      if (b == OP_RGB) {
+        if (end - p < 3) break;
+        memcpy(px, p, 3);
+        p += 3;
+      } else if (b == OP_RGBA) {
+        if (end - p < 4) break;
+        memcpy(px, p, 4);
+        p += 4;
+      } else if ((b & 0xc0) == OP_INDEX) {
+        memcpy(px, index[b], 4);
+      } else if ((b & 0xc0) == OP_DIFF) {
+        px[0] += ((b >> 4) & 3) - 2;
+        px[1] += ((b >> 2) & 3) - 2;
+        px[2] += (b & 3) - 2;
+      } else if ((b & 0xc0) == OP_LUMA) {
+        if (p == end) break;
+        uint8_t b2 = *p++;
+        int dg = (b & 0x3f) - 32;
+        px[0] += dg - 8 + ((b2 >> 4) & 0x0f);
+        px[1] += dg;
+        px[2] += dg - 8 + (b2 & 0x0f);
+      } else {
+        run = b & 0x3f;
+      }
+      memcpy(index[qoiHash(px)], px, 4);
+    }
+    memcpy(out, px, 4);
+  }
+}
+
+inline void readImage(const std::string &filename, Image &image) {
+  std::ifstream file(filename.c_str(), std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("readImage: cannot open " + filename);
+  }
+  // read in chunks: the end offset of a directory or pipe is not its size
+  std::vector<uint8_t> data;
+  char chunk[65536];
+  while (file.read(chunk, sizeof(chunk)) || file.gcount()) {
+    data.insert(data.end(), chunk, chunk + file.gcount());
+  }
+  if (file.bad() || data.empty()) {
+    throw std::runtime_error("readImage: cannot read " + filename);
+  }
+  if (isQOIFile(filename)) {
+    decodeQOI(data, image);
+    return;
+  }
+  unsigned int error = lodepng::decode(image.pixels, image.width, image.height, data);
+  if (error) {
+    throw std::runtime_error("readImage: " + filename + ": " + lodepng_error_text(error));
+  }
+}
+
+inline void writeImage(const std::string &filename, const Image &image, int compression = 6) {
+  std::vector<uint8_t> data;
+  if (isQOIFile(filename)) {
+    encodeQOI(image, data);
+  } else {
+    lodepng::State state;
+    LodePNGCompressSettings &zlib = state.encoder.zlibsettings;
+    if (compression <= 0) {
+      zlib.btype = 0;
+    } else {
+      compression = std::min(compression, 9);
+      zlib.windowsize = std::min(32768, 128 << compression);
+      zlib.nicematch = std::min(258, 16 * compression + 2);
+      zlib.lazymatching = compression >= 4;
+      // row filter selection is the most expensive part of fast encodes
+      state.encoder.filter_strategy = compression >= 4 ? LFS_MINSUM : LFS_ZERO;
+    }
+    unsigned int error = lodepng::encode(data, image.pixels, image.width, image.height, state);
+    if (error) {
+      throw std::runtime_error("writeImage: " + filename + ": " + lodepng_error_text(error));
+    }
+  }
+  std::ofstream file(filename.c_str(), std::ios::binary);
+  file.write((const char *) data.data(), data.size());
+  if (!file) {
+    throw std::runtime_error("writeImage: cannot write " + filename);
+  }
+}
+
 class Texture2D {
   private:
     GLuint _id;
     GLenum _internalFormat;
     unsigned int _w, _h;
+    int _levels;
+    bool _immutable;
   public:
-    Texture2D(GLenum pixelFormat) : _id(0), _internalFormat(pixelFormat), _w(0), _h(0) { };
-    Texture2D(GLenum pixelFormat, int w, int h, void *data, GLenum dataType = GL_UNSIGNED_BYTE) : _id(0), _internalFormat(pixelFormat), _w(w), _h(h) {
+    Texture2D(GLenum pixelFormat) : _id(0), _internalFormat(pixelFormat), _w(0), _h(0), _levels(0), _immutable(false) { };
+    Texture2D(GLenum pixelFormat, int w, int h, void *data, GLenum dataType = GL_UNSIGNED_BYTE) : _id(0), _internalFormat(pixelFormat), _w(w), _h(h), _levels(0), _immutable(false) {
       allocate(w, h, data, dataType);
     };
-    Texture2D(GLenum pixelFormat, const std::string filename) : _id(0), _internalFormat(pixelFormat), _w(0), _h(0) {
+    Texture2D(GLenum pixelFormat, const std::string filename) : _id(0), _internalFormat(pixelFormat), _w(0), _h(0), _levels(0), _immutable(false) {
       loadImage(filename);
     };
     ~Texture2D() {
       release();
     };
+    Texture2D(const Texture2D&) = delete;
+    Texture2D& operator=(const Texture2D&) = delete;
+    Texture2D(Texture2D &&other)
+      : _id(other._id), _internalFormat(other._internalFormat), _w(other._w), _h(other._h), _levels(other._levels), _immutable(other._immutable) {
+      other._id = 0;
+      other._w = other._h = 0;
+      other._levels = 0;
+      other._immutable = false;
+    };
+    Texture2D& operator=(Texture2D &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        _internalFormat = other._internalFormat;
+        _w = other._w, _h = other._h;
+        _levels = other._levels;
+        _immutable = other._immutable;
+        other._id = 0;
+        other._w = other._h = 0;
+        other._levels = 0;
+        other._immutable = false;
+      }
+      return *this;
+    };
     GLuint id() {
       return _id;
     };
+    unsigned int width() const {
+      return _w;
+    };
+    unsigned int height() const {
+      return _h;
+    };
+    GLenum internalFormat() const {
+      return _internalFormat;
+    };
+    /* number of mipmap levels of the storage */
+    int levels() const {
+      return _levels;
+    };
+    bool isImmutable() const {
+      return _immutable;
+    };
+    /* levels of a full mipmap chain down to 1x1 */
+    static int mipLevels(int w, int h) {
+      int levels = 1;
+      for (int size = std::max(w, h); size > 1; size /= 2) {
+        levels++;
+      }
+      return levels;
+    };
     int isCreated() {
       return (_id != 0);
     };
     void create() {
-      glGenTextures(1, &_id);
+      _id = StateCache::current().generate(TEXTURE_HANDLE);
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteTextures(1, &_id);
-      GL_CHECK_ERROR();
+      StateCache::current().deleteTexture(_id);
     };
     void bind() {
-      glBindTexture(GL_TEXTURE_2D, _id);
-      GL_CHECK_ERROR();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, _id);
     };
     void unbind() {
-      glBindTexture(GL_TEXTURE_2D, 0);
-      GL_CHECK_ERROR();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, 0);
     };
     void getImage(GLvoid *img, GLenum dataType = GL_UNSIGNED_BYTE, int level = 0) {
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
       bind();
       glGetTexImage(GL_TEXTURE_2D, level, getFormat(), dataType, img); 
       GL_CHECK_ERROR();
-      unbind();
-    };
-    void saveImage(const std::string filename, int level = 0) {
-      std::vector<uint8_t> img(_w * _h * 4);
-      getImage(img.data(), GL_UNSIGNED_BYTE, level);
-      unsigned int error = lodepng::encode(filename, img, _w, _h);
-      if (error) {
-        std::cout << "png write error: " << error << std::endl;
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
+    };
+    /* PNG or QOI by file extension (see writeImage()) */
+    void saveImage(const std::string filename, int level = 0, int compression = 6) {
+      Image img(_w, _h);
+      getImage(img.pixels.data(), GL_UNSIGNED_BYTE, level);
+      try {
+        writeImage(filename, img, compression);
+      } catch (std::runtime_error &e) {
+        std::cout << "image write error: " << e.what() << std::endl;
       }
     }
     void loadImage(const std::string filename, int level = 0) {
-        unsigned int w, h;
-        std::vector<uint8_t> img;
-        unsigned int error = lodepng::decode(img, w, h, filename);
-        if (error) {
-          std::cout << "png read error: " << error << std::endl;
-        } else {
-          allocate(w, h, img.data(), GL_UNSIGNED_BYTE, level);
+        Image img;
+        try {
+          readImage(filename, img);
+        } catch (std::runtime_error &e) {
+          std::cout << "image read error: " << e.what() << std::endl;
+          return;
         }
+        allocate(img.width, img.height, img.pixels.data(), GL_UNSIGNED_BYTE, level);
     }
     void setParameter(GLenum pname, GLint param) {
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
       bind();
       glTexParameteri(GL_TEXTURE_2D, pname, param);
       GL_CHECK_ERROR();
-      unbind();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
     };
     void setParameter(GLenum pname, GLfloat param) {
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
       bind();
       glTexParameterf(GL_TEXTURE_2D, pname, param);
       GL_CHECK_ERROR();
-      unbind();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
     };
     void allocate(int w, int h, void *data = NULL, GLenum dataType = GL_UNSIGNED_BYTE, int level = 0) {
+      if (_immutable) {
+        throw std::logic_error("Texture2D::allocate: the storage is immutable, use allocateStorage() and update()");
+      }
       if(!isCreated()) {
         create();
       }
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
       bind();
       _w = w;
       _h = h;
+      _levels = std::max(_levels, level + 1);
       glTexImage2D(GL_TEXTURE_2D, level, _internalFormat, w, h, /* border - "must be 0." */ 0, getFormat(), dataType, data);
       GL_CHECK_ERROR();
-      unbind();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
+    };
+    /*
+     * immutable storage for `levels` mipmap levels (glTexStorage2D, GL 4.2 or ARB_texture_storage):
+     * the driver allocates every level once and does not have to validate the texture at draw time.
+     * the contents are undefined until update(); a texture that already has immutable storage gets a new name.
+     */
+    void allocateStorage(int w, int h, int levels = 1) {
+      if (_immutable) {
+        release();
+        _id = 0;
+      }
+      if (!isCreated()) {
+        create();
+      }
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
+      bind();
+      _w = w;
+      _h = h;
+      _levels = levels;
+      if (StateCache::current().hasTextureStorage()) {
+        glTexStorage2D(GL_TEXTURE_2D, levels, _internalFormat, w, h);
+        _immutable = true;
+      } else {
+        for (int level = 0; level < levels; level++) {
+          glTexImage2D(GL_TEXTURE_2D, level, _internalFormat, std::max(1, w >> level), std::max(1, h >> level), 0, getFormat(), getStorageType(), NULL);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+      }
+      GL_CHECK_ERROR();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
+    };
+    /* overwrite a whole level without re-specifying the storage */
+    void update(const void *data, GLenum dataType = GL_UNSIGNED_BYTE, int level = 0) {
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
+      bind();
+      glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, std::max(1u, _w >> level), std::max(1u, _h >> level), getFormat(), dataType, data);
+      GL_CHECK_ERROR();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
+    };
+    /* fill levels 1 .. levels() - 1 from level 0 */
+    void generateMipmap() {
+      GLuint previous = StateCache::current().boundTexture(GL_TEXTURE_2D);
+      bind();
+      glGenerateMipmap(GL_TEXTURE_2D);
+      GL_CHECK_ERROR();
+      StateCache::current().bindTexture(GL_TEXTURE_2D, previous);
     };
     /* get "base internal format" from "sized internal format" */
     GLenum getFormat() {
@@ -284,6 +1426,27 @@ class Texture2D {
       }
       return 0;
     };
+    /* a data type that getFormat() accepts, for storage specified without data */
+    GLenum getStorageType() {
+      switch(_internalFormat) {
+        case GL_DEPTH24_STENCIL8:
+          return GL_UNSIGNED_INT_24_8;
+        case GL_DEPTH_COMPONENT16:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32F:
+        case GL_R16F:
+        case GL_R32F:
+        case GL_RG16F:
+        case GL_RG32F:
+        case GL_RGB9_E5:
+        case GL_RGB16F:
+        case GL_RGB32F:
+        case GL_RGBA16F:
+        case GL_RGBA32F:
+          return GL_FLOAT;
+      }
+      return GL_UNSIGNED_BYTE;
+    };
 
     size_t pixel_depth () {
       int count;
@@ -368,12 +1531,220 @@ class Texture2D {
     }
 };
 
+/*
+ * complete sampling state of a Sampler; the fields left out of the constructor have the GL defaults.
+ * maxAnisotropy > 1 needs EXT_texture_filter_anisotropic (ignored without it).
+ */
+struct SamplerState {
+  GLint minFilter, magFilter, wrapS, wrapT, wrapR, compareMode, compareFunc;
+  GLfloat minLod, maxLod, lodBias, maxAnisotropy;
+  GLfloat borderColor[4];
+  SamplerState(GLint filter = GL_LINEAR, GLint wrap = GL_CLAMP_TO_EDGE)
+    : minFilter(filter), magFilter(filter == GL_NEAREST ? GL_NEAREST : GL_LINEAR), wrapS(wrap), wrapT(wrap), wrapR(wrap),
+      compareMode(GL_NONE), compareFunc(GL_LEQUAL), minLod(-1000.0f), maxLod(1000.0f), lodBias(0.0f), maxAnisotropy(1.0f) {
+    std::fill(borderColor, borderColor + 4, 0.0f);
+  };
+  bool operator==(const SamplerState &other) const {
+    return !memcmp(this, &other, sizeof(SamplerState));
+  };
+  /* FNV-1a over the fields, which are all 4 bytes wide (no padding) */
+  struct Hash {
+    size_t operator()(const SamplerState &state) const {
+      const uint8_t *bytes = (const uint8_t *) &state;
+      uint32_t h = 2166136261u;
+      for (size_t i = 0; i < sizeof(SamplerState); i++) {
+        h = (h ^ bytes[i]) * 16777619u;
+      }
+      return h;
+    };
+  };
+};
+
+/* sampling state separate from the texture, so one texture can be sampled several ways */
+class Sampler {
+  private:
+    GLuint _id;
+    SamplerState _state;
+  public:
+    Sampler(const SamplerState &state = SamplerState()) : _id(0), _state(state) {};
+    ~Sampler() {
+      release();
+    };
+    Sampler(const Sampler&) = delete;
+    Sampler& operator=(const Sampler&) = delete;
+    Sampler(Sampler &&other) : _id(other._id), _state(other._state) {
+      other._id = 0;
+    };
+    Sampler& operator=(Sampler &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        _state = other._state;
+        other._id = 0;
+      }
+      return *this;
+    };
+    GLuint id() const {
+      return _id;
+    };
+    bool isCreated() const {
+      return (_id != 0);
+    };
+    const SamplerState& state() const {
+      return _state;
+    };
+    void create() {
+      _id = StateCache::current().generate(SAMPLER_HANDLE);
+      GL_CHECK_ERROR();
+      glSamplerParameteri(_id, GL_TEXTURE_MIN_FILTER, _state.minFilter);
+      glSamplerParameteri(_id, GL_TEXTURE_MAG_FILTER, _state.magFilter);
+      glSamplerParameteri(_id, GL_TEXTURE_WRAP_S, _state.wrapS);
+      glSamplerParameteri(_id, GL_TEXTURE_WRAP_T, _state.wrapT);
+      glSamplerParameteri(_id, GL_TEXTURE_WRAP_R, _state.wrapR);
+      glSamplerParameteri(_id, GL_TEXTURE_COMPARE_MODE, _state.compareMode);
+      glSamplerParameteri(_id, GL_TEXTURE_COMPARE_FUNC, _state.compareFunc);
+      glSamplerParameterf(_id, GL_TEXTURE_MIN_LOD, _state.minLod);
+      glSamplerParameterf(_id, GL_TEXTURE_MAX_LOD, _state.maxLod);
+      glSamplerParameterf(_id, GL_TEXTURE_LOD_BIAS, _state.lodBias);
+      glSamplerParameterfv(_id, GL_TEXTURE_BORDER_COLOR, _state.borderColor);
+      if (_state.maxAnisotropy > 1.0f && hasExtension("GL_EXT_texture_filter_anisotropic")) {
+        glSamplerParameterf(_id, GL_TEXTURE_MAX_ANISOTROPY_EXT, _state.maxAnisotropy);
+      }
+      GL_CHECK_ERROR();
+    };
+    void release() {
+      if (_id) {
+        StateCache::current().deleteSampler(_id);
+        _id = 0;
+      }
+    };
+    void bind(GLuint unit) {
+      if (!isCreated()) {
+        create();
+      }
+      StateCache::current().bindSampler(unit, _id);
+    };
+};
+
+/* one Sampler per distinct SamplerState */
+class SamplerCache {
+  private:
+    std::unordered_map<SamplerState, std::unique_ptr<Sampler>, SamplerState::Hash> _samplers;
+  public:
+    Sampler& get(const SamplerState &state) {
+      std::unique_ptr<Sampler> &sampler = _samplers[state];
+      if (!sampler) {
+        sampler.reset(new Sampler(state));
+      }
+      return *sampler;
+    };
+    size_t size() const {
+      return _samplers.size();
+    };
+};
+
+/*
+ * render targets (textures with immutable storage) shared by (format, width, height, levels):
+ *
+ *   Texture2D &target = pool.acquire(GL_RGBA16F, w, h);  // a free target of that key, or a new one
+ *   ... render into and read from target ...
+ *   pool.release(target);                                  // the next acquire() of that key may alias it
+ *   pool.endFrame();                                       // once per frame
+ *
+ * released targets are kept for maxIdleFrames frames, so a size that comes back (or a transient target
+ * acquired and released every frame) does not reallocate. the texture parameters are left at their
+ * defaults; sample the targets through a Sampler.
+ */
+class RenderTargetPool {
+  private:
+    struct Target {
+      std::unique_ptr<Texture2D> texture;
+      GLenum format;
+      int w, h, levels;
+      bool acquired;
+      int idleFrames;
+    };
+    std::vector<Target> _targets;
+    int _maxIdleFrames;
+  public:
+    RenderTargetPool(int maxIdleFrames = 60) : _maxIdleFrames(maxIdleFrames) {};
+    RenderTargetPool(const RenderTargetPool&) = delete;
+    RenderTargetPool& operator=(const RenderTargetPool&) = delete;
+    Texture2D& acquire(GLenum format, int w, int h, int levels = 1) {
+      for (size_t i = 0; i < _targets.size(); i++) {
+        Target &target = _targets[i];
+        if (!target.acquired && target.format == format && target.w == w && target.h == h && target.levels == levels) {
+          target.acquired = true;
+          target.idleFrames = 0;
+          return *target.texture;
+        }
+      }
+      Target target;
+      target.texture.reset(new Texture2D(format));
+      target.format = format;
+      target.w = w, target.h = h, target.levels = levels;
+      target.acquired = true;
+      target.idleFrames = 0;
+      target.texture->allocateStorage(w, h, levels);
+      _targets.push_back(std::move(target));
+      return *_targets.back().texture;
+    };
+    void release(Texture2D &texture) {
+      for (size_t i = 0; i < _targets.size(); i++) {
+        if (_targets[i].texture.get() == &texture) {
+          _targets[i].acquired = false;
+          return;
+        }
+      }
+      throw std::logic_error("RenderTargetPool::release: not a target of this pool");
+    };
+    /* delete the targets that have not been acquired for more than maxIdleFrames frames */
+    void endFrame() {
+      size_t kept = 0;
+      for (size_t i = 0; i < _targets.size(); i++) {
+        if (_targets[i].acquired || ++_targets[i].idleFrames <= _maxIdleFrames) {
+          if (kept != i) {
+            _targets[kept] = std::move(_targets[i]);
+          }
+          kept++;
+        }
+      }
+      _targets.resize(kept);
+    };
+    /* number of targets, acquired or not */
+    size_t size() const {
+      return _targets.size();
+    };
+};
+
 class Framebuffer {
   private:
     GLuint _id;
+    /* bind as the draw framebuffer, returning the previous one */
+    GLuint bindDraw() {
+      if (!isCreated()) {
+        create();
+      }
+      GLuint previous = StateCache::current().boundFramebuffer(GL_DRAW_FRAMEBUFFER);
+      StateCache::current().bindFramebuffer(GL_DRAW_FRAMEBUFFER, _id);
+      return previous;
+    };
   public:
     Framebuffer() : _id(0) { };
     ~Framebuffer() { release(); };
+    Framebuffer(const Framebuffer&) = delete;
+    Framebuffer& operator=(const Framebuffer&) = delete;
+    Framebuffer(Framebuffer &&other) : _id(other._id) {
+      other._id = 0;
+    };
+    Framebuffer& operator=(Framebuffer &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        other._id = 0;
+      }
+      return *this;
+    };
     GLuint id() {
       return _id;
     };
@@ -381,53 +1752,51 @@ class Framebuffer {
       return (_id != 0);
     };
     void create() {
-      glGenFramebuffers(1, &_id);
+      _id = StateCache::current().generate(FRAMEBUFFER_HANDLE);
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteFramebuffers(1, &_id);
-      GL_CHECK_ERROR();
+      StateCache::current().deleteFramebuffer(_id);
     };
     void bind() {
       if (!isCreated()) {
         create();
       }
-      glBindFramebuffer(GL_FRAMEBUFFER, _id);
-      GL_CHECK_ERROR();
+      StateCache::current().bindFramebuffer(GL_FRAMEBUFFER, _id);
     };
     void unbind() {
-      glBindFramebuffer(GL_FRAMEBUFFER, 0);
-      GL_CHECK_ERROR();
+      StateCache::current().bindFramebuffer(GL_FRAMEBUFFER, 0);
     };
     void attach() {};
+    /* attachments are made on GL_DRAW_FRAMEBUFFER and the previous binding is restored */
     template <typename... Args>
       void attach(GLenum attachmentType, Texture2D &texture, Args&&... args) {
-        bind();
-        glFramebufferTexture2D(GL_FRAMEBUFFER,
+        GLuint previous = bindDraw();
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
                                attachmentType,
                                GL_TEXTURE_2D,
                                texture.id(), 0);
         GL_CHECK_ERROR();
         attach(args...);
-        unbind();
+        StateCache::current().bindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
       };
     template <typename... Args>
       void attach(GLenum attachmentType, Renderbuffer &renderBuffer, Args... args) {
-        bind();
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachmentType, GL_RENDERBUFFER, renderBuffer.id());
+        GLuint previous = bindDraw();
+        glFramebufferRenderbuffer(GL_DRAW_FRAMEBUFFER, attachmentType, GL_RENDERBUFFER, renderBuffer.id());
         GL_CHECK_ERROR();
         attach(args...);
-        unbind();
+        StateCache::current().bindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
       };
     void detach(GLenum attachmentType) {
-        bind();
+        GLuint previous = bindDraw();
         /* attach texture id 0 */
-        glFramebufferTexture2D(GL_FRAMEBUFFER,
+        glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER,
                                attachmentType,
                                GL_TEXTURE_2D,
                                0, 0);
         GL_CHECK_ERROR();
-        unbind();
+        StateCache::current().bindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
     };
 };
 
@@ -437,6 +1806,19 @@ class VertexArray {
   public:
     VertexArray() : _id(0) {};
     ~VertexArray() { release(); };
+    VertexArray(const VertexArray&) = delete;
+    VertexArray& operator=(const VertexArray&) = delete;
+    VertexArray(VertexArray &&other) : _id(other._id) {
+      other._id = 0;
+    };
+    VertexArray& operator=(VertexArray &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        other._id = 0;
+      }
+      return *this;
+    };
     GLuint id() {
       return _id;
     };
@@ -444,23 +1826,25 @@ class VertexArray {
       return (_id != 0);
     };
     void create() {
-      glGenVertexArrays(1, &_id);
+      _id = StateCache::current().generate(VERTEX_ARRAY_HANDLE);
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteVertexArrays(1, &_id);
-      GL_CHECK_ERROR();
+      StateCache::current().deleteVertexArray(_id);
     };
     void bind() {
       if (!isCreated()) {
         create();
       }
-      glBindVertexArray(_id);
-      GL_CHECK_ERROR();
+      StateCache::current().bindVertexArray(_id);
     };
     void unbind() {
-      glBindVertexArray(0);
-      GL_CHECK_ERROR();
+      StateCache::current().bindVertexArray(0);
+    };
+    /* make the attribute at index advance once per `divisor` instances instead of per vertex */
+    void setAttributeDivisor(GLuint index, GLuint divisor) {
+      bind();
+      StateCache::current().vertexAttribDivisor(index, divisor);
     };
 
 };
@@ -470,10 +1854,18 @@ template <typename T> class Buffer {
     GLuint _id;
     GLsizei _tupleSize;
     GLenum _dataType, _bufferType, _usage;
+    GLuint _divisor;
     bool _isMutable;
+    size_t _size;
+    // streaming mode
+    T *_mapped;
+    size_t _frameCount;
+    int _frame;
+    FrameFences _fences;
   public:
     Buffer(GLenum a_bufferType, GLenum a_usage = GL_STATIC_DRAW, bool a_mutable = true, GLenum a_dataType = 0)
-      : _id(0), _bufferType(a_bufferType), _usage(a_usage), _isMutable(a_mutable) {
+      : _id(0), _bufferType(a_bufferType), _usage(a_usage), _divisor(0), _isMutable(a_mutable), _size(0),
+        _mapped(NULL), _frameCount(0), _frame(0), _fences() {
         T tmp_t(0);
         if (a_dataType) {
           _dataType = a_dataType;
@@ -484,6 +1876,39 @@ template <typename T> class Buffer {
     ~Buffer() {
       release();
     };
+    /* a streaming mapping moves with the name */
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+    Buffer(Buffer &&other)
+      : _id(other._id), _tupleSize(other._tupleSize), _dataType(other._dataType), _bufferType(other._bufferType), _usage(other._usage),
+        _divisor(other._divisor), _isMutable(other._isMutable), _size(other._size),
+        _mapped(other._mapped), _frameCount(other._frameCount), _frame(other._frame), _fences(std::move(other._fences)) {
+      other._id = 0;
+      other._size = 0;
+      other._mapped = NULL;
+      other._frameCount = 0;
+    };
+    Buffer& operator=(Buffer &&other) {
+      if (this != &other) {
+        _fences.waitAll();
+        release();
+        _id = other._id;
+        _tupleSize = other._tupleSize;
+        _dataType = other._dataType, _bufferType = other._bufferType, _usage = other._usage;
+        _divisor = other._divisor;
+        _isMutable = other._isMutable;
+        _size = other._size;
+        _mapped = other._mapped;
+        _frameCount = other._frameCount;
+        _frame = other._frame;
+        _fences = std::move(other._fences);
+        other._id = 0;
+        other._size = 0;
+        other._mapped = NULL;
+        other._frameCount = 0;
+      }
+      return *this;
+    };
     GLuint id() {
       return _id;
     };
@@ -502,24 +1927,32 @@ template <typename T> class Buffer {
     GLsizei tupleSize() {
       return _tupleSize;
     };
+    /* number of elements */
+    size_t size() const {
+      return _size;
+    };
+    /* attribute divisor used when bound to a ShaderProgram attribute: 0 per vertex, 1 per instance */
+    GLuint divisor() {
+      return _divisor;
+    };
+    void setDivisor(GLuint divisor) {
+      _divisor = divisor;
+    };
     void create() {
-      glGenBuffers(1, &_id);
+      _id = StateCache::current().generate(BUFFER_HANDLE);
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteBuffers(1, &_id);
-      GL_CHECK_ERROR();
+      StateCache::current().deleteBuffer(_id);
     };
     void bind() {
       if (!isCreated()) {
         create();
       }
-      glBindBuffer(_bufferType, _id);
-      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, _id);
     };
     void unbind() {
-      glBindBuffer(_bufferType, 0);
-      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, 0);
     };
     void setDataType(GLfloat) {
       _dataType = GL_FLOAT;
@@ -536,45 +1969,619 @@ template <typename T> class Buffer {
     void setDataType(GLshort) {
       _dataType = GL_SHORT;
     };
-    void setDataType(GLushort) {
-      _dataType = GL_UNSIGNED_SHORT;
+    void setDataType(GLushort) {
+      _dataType = GL_UNSIGNED_SHORT;
+    };
+    void setDataType(GLint) {
+      _dataType = GL_INT;
+    };
+    void setDataType(GLuint) {
+      _dataType = GL_UNSIGNED_INT;
+    };
+    /* size in bytes; data may be NULL to leave the contents undefined */
+    void allocate(const T *data, int a_tupleSize, GLsizeiptr size) {
+      if (isStreaming()) {
+        _fences.waitAll();
+        release();
+        _id = 0;
+        _mapped = NULL;
+      }
+      if (!isCreated()) {
+        create();
+      }
+      _tupleSize = a_tupleSize;
+      _size = size / sizeof(T);
+      GLuint previous = StateCache::current().boundBuffer(_bufferType);
+      bind();
+      if (_isMutable) {
+        glBufferData(_bufferType, size, data, _usage);
+        GL_CHECK_ERROR();
+      } else {
+        glBufferStorage(_bufferType, size, data, _usage);
+        GL_CHECK_ERROR();
+      }
+      StateCache::current().bindBuffer(_bufferType, previous);
+    };
+    /*
+     * streaming mode: immutable storage for `frames` regions of `count` elements, persistently mapped.
+     * every frame writes into the span returned by beginFrame() and draws from frameOffset();
+     * beginFrame() only waits if the GPU is still reading the region written `frames` frames ago.
+     *
+     *   Span<GLfloat> data = buf.beginFrame();
+     *   // write data[0 .. count)
+     *   program.bind(vao, "attr", buf, buf.frameOffset());
+     *   glDraw...
+     *   buf.endFrame();
+     */
+    void allocateStreaming(size_t count, int a_tupleSize, int frames = 3) {
+      if (isCreated()) {
+        // immutable storage cannot be re-specified
+        _fences.waitAll();
+        release();
+        _id = 0;
+      }
+      create();
+      _tupleSize = a_tupleSize;
+      _size = count * frames;
+      _frameCount = count;
+      _frame = 0;
+      _fences.resize(frames);
+      const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      GLsizeiptr size = sizeof(T) * count * frames;
+      GLuint previous = StateCache::current().boundBuffer(_bufferType);
+      bind();
+      glBufferStorage(_bufferType, size, NULL, flags);
+      GL_CHECK_ERROR();
+      _mapped = (T *) glMapBufferRange(_bufferType, 0, size, flags);
+      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, previous);
+    };
+    bool isStreaming() const {
+      return _mapped != NULL;
+    };
+    Span<T> beginFrame() {
+      _frame = (_frame + 1) % _fences.size();
+      _fences.wait(_frame);
+      return Span<T>(_mapped + _frame * _frameCount, _frameCount);
+    };
+    /* byte offset of the region of the current frame */
+    intptr_t frameOffset() const {
+      return _frame * _frameCount * sizeof(T);
+    };
+    /* fence the region after the last draw that reads it */
+    void endFrame() {
+      _fences.fence(_frame);
+    };
+    void allocate(Span<const T> data, int a_tupleSize) {
+      allocate(data.data(), a_tupleSize, sizeof(T) * data.size());
+    };
+    template <size_t i>
+      void allocate(const std::array<T, i> &array, int a_tupleSize) {
+        allocate(array.data(), a_tupleSize, sizeof(T) * i);
+      };
+    void allocate(const std::vector<T> &vec, int a_tupleSize) {
+      allocate(vec.data(), a_tupleSize, sizeof(T) * vec.size());
+    };
+    /* overwrite elements [offset, offset + data.size()) without re-specifying the storage */
+    void update(size_t offset, Span<const T> data) {
+      if (!data.size()) {
+        return;
+      }
+      GLuint previous = StateCache::current().boundBuffer(_bufferType);
+      bind();
+      glBufferSubData(_bufferType, offset * sizeof(T), data.size() * sizeof(T), data.data());
+      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, previous);
+    };
+    /*
+     * replace the whole contents, orphaning the old storage: draws still reading it keep their copy
+     * instead of making this call wait for them (mutable buffers only)
+     */
+    void respecify(Span<const T> data) {
+      if (!_isMutable) {
+        throw std::logic_error("Buffer::respecify: the storage is immutable");
+      }
+      if (!isCreated()) {
+        create();
+      }
+      _size = data.size();
+      GLuint previous = StateCache::current().boundBuffer(_bufferType);
+      bind();
+      glBufferData(_bufferType, data.size() * sizeof(T), NULL, _usage);
+      glBufferSubData(_bufferType, 0, data.size() * sizeof(T), data.data());
+      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, previous);
+    };
+    /* map elements [offset, offset + count) for writing; unmap() before drawing */
+    Span<T> map(size_t offset, size_t count, GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT) {
+      GLuint previous = StateCache::current().boundBuffer(_bufferType);
+      bind();
+      T *data = (T *) glMapBufferRange(_bufferType, offset * sizeof(T), count * sizeof(T), access);
+      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, previous);
+      return Span<T>(data, count);
+    };
+    void unmap() {
+      GLuint previous = StateCache::current().boundBuffer(_bufferType);
+      bind();
+      glUnmapBuffer(_bufferType);
+      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(_bufferType, previous);
+    };
+#ifdef USE_BOOST
+    void allocate(const boost::multi_array<T, 2> &array) {
+      allocate(array.data(), array.shape()[1], sizeof(T) * array.num_elements());
+    }
+#endif
+  };
+
+/* uniform block storage for one std140 struct T */
+template <typename T> class UniformBuffer : public Buffer<GLubyte> {
+  public:
+    UniformBuffer(GLenum a_usage = GL_DYNAMIC_DRAW) : Buffer<GLubyte>(GL_UNIFORM_BUFFER, a_usage) {};
+    void allocate(const T *value = NULL) {
+      Buffer<GLubyte>::allocate((const GLubyte *) value, 1, sizeof(T));
+    };
+    void update(const T &value) {
+      if (!isCreated()) {
+        allocate(&value);
+        return;
+      }
+      GLuint previous = StateCache::current().boundBuffer(GL_UNIFORM_BUFFER);
+      bind();
+      glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &value);
+      GL_CHECK_ERROR();
+      StateCache::current().bindBuffer(GL_UNIFORM_BUFFER, previous);
+    };
+    /* bind to the uniform block binding point (see ShaderProgram::setUniformBlockBinding) */
+    void bindBase(GLuint binding) {
+      if (!isCreated()) {
+        allocate();
+      }
+      StateCache::current().bindBufferBase(GL_UNIFORM_BUFFER, binding, id());
+    };
+};
+
+/* fixed number of worker threads running queued jobs; the first exception thrown by a job is rethrown by wait() */
+class ThreadPool {
+  private:
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()> > _jobs;
+    std::mutex _mutex;
+    std::condition_variable _wake, _idle;
+    size_t _active;
+    bool _stop;
+    std::exception_ptr _error;
+    void work() {
+      std::unique_lock<std::mutex> lock(_mutex);
+      for (;;) {
+        _wake.wait(lock, [this] { return _stop || !_jobs.empty(); });
+        if (_jobs.empty()) {
+          return;
+        }
+        std::function<void()> job = std::move(_jobs.front());
+        _jobs.pop_front();
+        _active++;
+        lock.unlock();
+        try {
+          job();
+        } catch (...) {
+          lock.lock();
+          if (!_error) {
+            _error = std::current_exception();
+          }
+          lock.unlock();
+        }
+        lock.lock();
+        _active--;
+        if (_jobs.empty() && !_active) {
+          _idle.notify_all();
+        }
+      }
+    };
+  public:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    /* threads = 0: one per hardware thread */
+    ThreadPool(int threads = 0) : _active(0), _stop(false) {
+      if (threads <= 0) {
+        threads = std::max(1, (int) std::thread::hardware_concurrency());
+      }
+      for (int i = 0; i < threads; i++) {
+        _workers.push_back(std::thread(&ThreadPool::work, this));
+      }
+    };
+    /* runs the remaining jobs before returning */
+    ~ThreadPool() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+      }
+      _wake.notify_all();
+      for (size_t i = 0; i < _workers.size(); i++) {
+        _workers[i].join();
+      }
+    };
+    int size() const {
+      return (int) _workers.size();
+    };
+    void push(std::function<void()> job) {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push_back(std::move(job));
+      }
+      _wake.notify_one();
+    };
+    /* block until every queued job has run */
+    void wait() {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _idle.wait(lock, [this] { return _jobs.empty() && !_active; });
+      if (_error) {
+        std::exception_ptr error = _error;
+        _error = std::exception_ptr();
+        std::rethrow_exception(error);
+      }
+    };
+};
+
+/*
+ * asynchronous replacement for Texture2D::saveImage() when saving a frame sequence:
+ *
+ *   ImageCapture capture;
+ *   for (...) {
+ *     render into texture
+ *     capture.save(texture, filename);  // glReadPixels into a pixel pack buffer, fenced
+ *   }
+ *   capture.finish();
+ *
+ * the pixel pack buffers form a ring of `frames`: a readback is mapped only when its buffer is
+ * reused `frames` saves later (or by finish()), so the render thread does not wait for the GPU,
+ * and the image is encoded on the thread pool. the GL context has to be current in finish() and
+ * the destructor.
+ */
+class ImageCapture {
+  private:
+    struct Readback {
+      Buffer<GLubyte> buffer;
+      std::string filename;
+      unsigned int w, h;
+      bool pending;
+      Readback() : buffer(GL_PIXEL_PACK_BUFFER, GL_STREAM_READ), w(0), h(0), pending(false) {};
+    };
+    std::vector<Readback> _readbacks;
+    FrameFences _fences;
+    Framebuffer _framebuffer;
+    int _next, _compression;
+    ThreadPool _pool;
+    void retrieve(int i) {
+      Readback &readback = _readbacks[i];
+      if (!readback.pending) {
+        return;
+      }
+      _fences.wait(i);
+      size_t bytes = readback.w * readback.h * 4;
+      std::shared_ptr<Image> img = std::make_shared<Image>(readback.w, readback.h);
+      Span<GLubyte> data = readback.buffer.map(0, bytes, GL_MAP_READ_BIT);
+      std::copy(data.begin(), data.end(), img->pixels.begin());
+      readback.buffer.unmap();
+      readback.pending = false;
+      std::string filename = readback.filename;
+      int compression = _compression;
+      _pool.push([img, filename, compression] {
+        try {
+          writeImage(filename, *img, compression);
+        } catch (std::exception &e) {
+          std::cout << "image write error: " << e.what() << std::endl;
+        }
+      });
     };
-    void setDataType(GLint) {
-      _dataType = GL_INT;
+  public:
+    ImageCapture(int frames = 3, int threads = 0) : _readbacks(frames), _fences(frames), _next(0), _compression(6), _pool(threads) {};
+    ImageCapture(const ImageCapture&) = delete;
+    ImageCapture& operator=(const ImageCapture&) = delete;
+    /* call finish() first to see the errors; here they are only logged */
+    ~ImageCapture() {
+      try {
+        finish();
+      } catch (std::exception &e) {
+        std::cout << "image capture error: " << e.what() << std::endl;
+      }
     };
-    void setDataType(GLuint) {
-      _dataType = GL_UNSIGNED_INT;
+    /* PNG compression level of the following saves (see writeImage()) */
+    void setCompression(int level) {
+      _compression = level;
+    };
+    /* queue level 0 of a color-renderable texture as an RGBA8 PNG or QOI image */
+    void save(Texture2D &texture, const std::string &filename) {
+      int i = _next;
+      _next = (_next + 1) % (int) _readbacks.size();
+      retrieve(i);
+      Readback &readback = _readbacks[i];
+      readback.filename = filename;
+      readback.w = texture.width(), readback.h = texture.height();
+      size_t bytes = readback.w * readback.h * 4;
+      if (readback.buffer.size() != bytes) {
+        readback.buffer.allocate(NULL, 4, bytes);
+      }
+      // attached on every save: a deleted texture stays attached here and its name can be reused
+      _framebuffer.attach(GL_COLOR_ATTACHMENT0, texture);
+      StateCache &state = StateCache::current();
+      GLuint previousFramebuffer = state.boundFramebuffer(GL_READ_FRAMEBUFFER), previousBuffer = state.boundBuffer(GL_PIXEL_PACK_BUFFER);
+      state.bindFramebuffer(GL_READ_FRAMEBUFFER, _framebuffer.id());
+      state.bindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer.id());
+      glReadPixels(0, 0, readback.w, readback.h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+      GL_CHECK_ERROR();
+      state.bindBuffer(GL_PIXEL_PACK_BUFFER, previousBuffer);
+      state.bindFramebuffer(GL_READ_FRAMEBUFFER, previousFramebuffer);
+      _fences.fence(i);
+      readback.pending = true;
+    };
+    /* map the outstanding readbacks (oldest first) and wait until every image is written */
+    void finish() {
+      for (size_t k = 0; k < _readbacks.size(); k++) {
+        retrieve((_next + k) % _readbacks.size());
+      }
+      _pool.wait();
     };
-    void allocate(T *data, int a_tupleSize, int size) {
-      if (!isCreated()) {
-        create();
+};
+/*
+ * image files decoded and encoded on a thread pool:
+ *
+ *   ImageIO io;
+ *   for (...) {
+ *     io.load(textures[i], filenames[i]);  // returns immediately
+ *   }
+ *   io.finish();  // allocates each texture as soon as its image is decoded
+ *
+ * textures are only touched in upload() and finish(), which have to be called on the GL thread;
+ * calling upload() once per frame streams textures in while rendering. the textures have to
+ * outlive their requests.
+ */
+class ImageIO {
+  private:
+    struct Decoded {
+      Texture2D *texture;
+      int level;
+      Image image;
+      std::string error;
+    };
+    std::mutex _mutex;
+    std::condition_variable _ready;
+    std::vector<std::unique_ptr<Decoded> > _decoded;
+    size_t _pending;
+    int _compression;
+    // destroyed first: the remaining jobs still use the members above
+    ThreadPool _pool;
+  public:
+    ImageIO(int threads = 0) : _pending(0), _compression(6), _pool(threads) {};
+    ImageIO(const ImageIO&) = delete;
+    ImageIO& operator=(const ImageIO&) = delete;
+    /* PNG compression level of the following saves (see writeImage()) */
+    void setCompression(int level) {
+      _compression = level;
+    };
+    void load(Texture2D &texture, const std::string &filename, int level = 0) {
+      _pending++;
+      Texture2D *target = &texture;
+      _pool.push([this, target, filename, level] {
+        std::unique_ptr<Decoded> decoded(new Decoded());
+        decoded->texture = target;
+        decoded->level = level;
+        // the entry is pushed even on failure, finish() waits for every one
+        try {
+          readImage(filename, decoded->image);
+        } catch (std::exception &e) {
+          decoded->error = e.what();
+        }
+        std::lock_guard<std::mutex> lock(_mutex);
+        _decoded.push_back(std::move(decoded));
+        _ready.notify_one();
+      });
+    };
+    void save(const std::string &filename, Image image) {
+      std::shared_ptr<Image> img = std::make_shared<Image>(std::move(image));
+      int compression = _compression;
+      _pool.push([img, filename, compression] {
+        try {
+          writeImage(filename, *img, compression);
+        } catch (std::exception &e) {
+          std::cout << "image write error: " << e.what() << std::endl;
+        }
+      });
+    };
+    /* allocate the textures whose images are decoded; returns the number of loads still in flight */
+    size_t upload() {
+      std::vector<std::unique_ptr<Decoded> > ready;
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        ready.swap(_decoded);
       }
-      _tupleSize = a_tupleSize;
-      bind();
-      if (_isMutable) {
-        glBufferData(_bufferType, size, data, _usage);
-        GL_CHECK_ERROR();
-      } else {
-        glBufferStorage(_bufferType, size, data, _usage);
-        GL_CHECK_ERROR();
+      for (size_t i = 0; i < ready.size(); i++) {
+        Decoded &decoded = *ready[i];
+        if (decoded.error.empty()) {
+          decoded.texture->allocate(decoded.image.width, decoded.image.height, decoded.image.pixels.data(), GL_UNSIGNED_BYTE, decoded.level);
+        } else {
+          std::cout << "image read error: " << decoded.error << std::endl;
+        }
+      }
+      _pending -= ready.size();
+      return _pending;
+    };
+    /* upload every load and wait for the saves */
+    void finish() {
+      while (upload()) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _ready.wait(lock, [this] { return !_decoded.empty(); });
       }
-      unbind();
+      _pool.wait();
     };
-    template <int i>
-      void allocate(std::array<T, i> array, int a_tupleSize) {
-        allocate(array.data(), a_tupleSize, sizeof(T) * i);
-      };
-    void allocate(std::vector<T> vec, int a_tupleSize) {
-      allocate(vec.data(), a_tupleSize, sizeof(T) * vec.size());
+};
+
+
+
+/* whole text of a shader source file; throws std::ios_base::failure */
+inline std::string readSourceFile(const std::string &filename) {
+  std::ifstream file;
+  std::stringstream sourceStream;
+  file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+  file.open(filename);
+  sourceStream << file.rdbuf();
+  return sourceStream.str();
+}
+
+/* expand #include "name" in filename into out; stack holds the files being expanded */
+inline void expandIncludes(const std::string &filename, std::vector<std::string> &files,
+                           std::vector<std::string> &stack, std::string &out) {
+  if (std::find(stack.begin(), stack.end(), filename) != stack.end()) {
+    throw std::runtime_error("recursive #include of: " + filename);
+  }
+  size_t index = std::find(files.begin(), files.end(), filename) - files.begin();
+  if (index == files.size()) {
+    files.push_back(filename);
+  }
+  // GLSL has no file names in #line, the second number indexes files
+  std::string source = " " + std::to_string(index) + "\n";
+  if (!stack.empty()) {
+    out += "#line 1" + source;
+  }
+  std::string directory = "";
+  if (filename.find_last_of("/") != std::string::npos) {
+    directory = filename.substr(0, filename.find_last_of("/") + 1);
+  }
+  std::istringstream text(readSourceFile(filename));
+  std::string line;
+  stack.push_back(filename);
+  for (int number = 1; std::getline(text, line); number++) {
+    size_t start = line.find_first_not_of(" \t");
+    if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+      out += line + "\n";
+      continue;
+    }
+    size_t open = line.find('"', start + 8), close = line.find('"', open + 1);
+    if (open == std::string::npos || close == std::string::npos) {
+      throw std::runtime_error("malformed #include in: " + filename);
+    }
+    expandIncludes(directory + line.substr(open + 1, close - open - 1), files, stack, out);
+    out += "#line " + std::to_string(number + 1) + source;
+  }
+  stack.pop_back();
+}
+
+/*
+ * text of a shader source file with #include "name" (relative to the including file) expanded
+ *   files receives every file read, the top one first; compiler messages refer to them by index.
+ */
+inline std::string preprocessSourceFile(const std::string &filename, std::vector<std::string> *files = NULL) {
+  std::vector<std::string> read, stack;
+  std::string out;
+  expandIncludes(filename, read, stack, out);
+  if (files) {
+    *files = read;
+  }
+  return out;
+}
+
+/* shader stage from the file extension (.vert, .frag, ...) */
+inline GLenum shaderTypeOf(const std::string &filename) {
+  std::string extension = "";
+  if (filename.find_last_of(".") != std::string::npos) {
+    extension = filename.substr(filename.find_last_of("."));
+  }
+  if (extension == ".vert" || extension == ".glslv") {
+    return GL_VERTEX_SHADER;
+  } else if (extension == ".tesc" || extension == ".tsc") {
+    return GL_TESS_CONTROL_SHADER;
+  } else if (extension == ".tese" || extension == ".tse") {
+    return GL_TESS_EVALUATION_SHADER;
+  } else if (extension == ".geom" || extension == ".glslg") {
+    return GL_GEOMETRY_SHADER;
+  } else if (extension == ".frag" || extension == ".glslf") {
+    return GL_FRAGMENT_SHADER;
+  } else if (extension == ".comp"|| extension == ".glslc") {
+    return GL_COMPUTE_SHADER;
+  }
+  throw std::runtime_error("cannot detect the shader type of: " + filename);
+}
+
+/* #define name value, ordered by name so equal sets give equal sources */
+typedef std::map<std::string, std::string> DefineSet;
+
+/*
+ * stages of a program read from files, plus #defines inserted after the #version line of every stage
+ *   ProgramSource src("a.vert", "a.frag");
+ *   src.define("USE_FOG");
+ */
+struct ProgramSource {
+  struct Stage {
+    GLenum type;
+    std::string filename, text;
+    // the stage file and everything it includes
+    std::vector<std::string> files;
+  };
+  std::vector<Stage> stages;
+  std::string defines;
+
+  ProgramSource() {};
+  template <typename... Args>
+    ProgramSource(const char* filename, Args&&... args) {
+      add(filename, args...);
     };
-#ifdef USE_BOOST
-    template <int i, int j>
-    void allocate(boost::multi_array<T, 2> array) {
-      allocate(array.data(), array.shape()[1], sizeof(T) * array.num_elements());
+  ProgramSource& add() {
+    return *this;
+  };
+  template <typename... Args>
+    ProgramSource& add(const char* filename, Args&&... args) {
+      Stage stage = { shaderTypeOf(filename), filename, "", std::vector<std::string>() };
+      stage.text = preprocessSourceFile(filename, &stage.files);
+      stages.push_back(stage);
+      return add(args...);
+    };
+  ProgramSource& define(const std::string &name, const std::string &value = "") {
+    defines += "#define " + name + (value.empty() ? "" : " " + value) + "\n";
+    return *this;
+  };
+  ProgramSource& define(const DefineSet &set) {
+    for (DefineSet::const_iterator it = set.begin(); it != set.end(); ++it) {
+      define(it->first, it->second);
     }
-#endif
+    return *this;
+  };
+  /* read the stage files again, keeping the defines */
+  void reload() {
+    for (size_t i = 0; i < stages.size(); i++) {
+      stages[i].text = preprocessSourceFile(stages[i].filename, &stages[i].files);
+    }
+  };
+  /* true if any stage includes one of files */
+  bool reads(const std::vector<std::string> &files) const {
+    for (size_t i = 0; i < stages.size(); i++) {
+      for (size_t j = 0; j < files.size(); j++) {
+        if (std::find(stages[i].files.begin(), stages[i].files.end(), files[j]) != stages[i].files.end()) {
+          return true;
+        }
+      }
+    }
+    return false;
+  };
+  /* text passed to glShaderSource */
+  std::string source(size_t i) const {
+    const std::string &text = stages[i].text;
+    if (defines.empty()) {
+      return text;
+    }
+    size_t pos = 0;
+    if (text.compare(0, 8, "#version") == 0) {
+      pos = text.find('\n');
+      pos = (pos == std::string::npos) ? text.length() : pos + 1;
+      return text.substr(0, pos) + defines + "#line 2 0\n" + text.substr(pos);
+    }
+    return defines + "#line 1 0\n" + text;
   };
+};
 
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
 
 class Shader {
   private:
@@ -583,6 +2590,20 @@ class Shader {
   public:
     Shader(GLuint type) : _id(0), _type(type) {};
     ~Shader() { release(); };
+    Shader(const Shader&) = delete;
+    Shader& operator=(const Shader&) = delete;
+    Shader(Shader &&other) : _id(other._id), _type(other._type) {
+      other._id = 0;
+    };
+    Shader& operator=(Shader &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        _type = other._type;
+        other._id = 0;
+      }
+      return *this;
+    };
     GLuint id() {
       return _id;
     };
@@ -594,8 +2615,10 @@ class Shader {
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteShader(_id);
-      GL_CHECK_ERROR();
+      if (_id) {
+        glDeleteShader(_id);
+        GL_CHECK_ERROR();
+      }
     };
     void setSourceString(std::string source) {
       const GLchar *gl_source;
@@ -607,15 +2630,24 @@ class Shader {
       glShaderSource(_id, 1, &gl_source, &length);
       GL_CHECK_ERROR();
     };
-    void compile() {
+    /* start compiling; the result is not queried until compileStatus() */
+    void submit() {
       if (!isCreated()) {
         create();
       }
       glCompileShader(_id);
       GL_CHECK_ERROR();
-      GLint success = 0;
+    };
+    /* waits for the compiler */
+    bool compileStatus() {
+      GLint success = GL_FALSE;
       glGetShaderiv(_id, GL_COMPILE_STATUS, &success);
-      if (success == GL_FALSE) {
+      GL_CHECK_ERROR();
+      return success != GL_FALSE;
+    };
+    void compile() {
+      submit();
+      if (!compileStatus()) {
         std::cout << infolog() << std::endl;
         throw std::runtime_error("shader compile failed");
       }
@@ -625,12 +2657,7 @@ class Shader {
       compile();
     };
     void compileFromSourceFile(std::string filename) {
-      std::ifstream file;
-      std::stringstream sourceStream;
-      file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-      file.open(filename);
-      sourceStream << file.rdbuf();
-      compileFromSource(sourceStream.str());
+      compileFromSource(preprocessSourceFile(filename));
     };
     std::string infolog() {
       GLint len;
@@ -651,13 +2678,275 @@ class Shader {
     };
 };
 
+/*
+ * linked program binaries on disk (glGetProgramBinary / glProgramBinary)
+ *   files are named by a 64-bit FNV-1a hash of the stage types, the sources with their defines
+ *   and GL_VENDOR / GL_RENDERER / GL_VERSION, so a driver update invalidates them.
+ *   a binary the driver rejects counts as a miss and the program is compiled from source.
+ */
+class ProgramBinaryCache {
+  public:
+    struct Statistics {
+      size_t hits, misses, rejected;
+    };
+  private:
+    static const uint32_t MAGIC = 0x42504c47; // "GLPB"
+    std::string _directory;
+    int _supported;
+    // GL_PROGRAM_BINARY_FORMATS of the context
+    std::vector<GLint> _formats;
+    Statistics _statistics;
+
+    static uint64_t fnv1a(uint64_t h, const void *data, size_t size) {
+      const unsigned char *p = (const unsigned char *) data;
+      for (size_t i = 0; i < size; i++) {
+        h = (h ^ p[i]) * 1099511628211ull;
+      }
+      return h;
+    };
+    static uint64_t fnv1a(uint64_t h, const char *s) {
+      // glGetString() may return NULL without a context
+      return s ? fnv1a(h, s, strlen(s) + 1) : h;
+    };
+    std::string path(uint64_t key) const {
+      char name[32];
+      snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long) key);
+      return _directory + name;
+    };
+  public:
+    ProgramBinaryCache(const std::string &directory = ".shadercache")
+      : _directory(directory), _supported(-1), _statistics() {};
+    const std::string& directory() const {
+      return _directory;
+    };
+    Statistics statistics() const {
+      return _statistics;
+    };
+    /* GL 4.1 or ARB_get_program_binary, and at least one binary format */
+    bool isSupported() {
+      if (_supported < 0) {
+        GLint formats = 0;
+        if (hasVersion(4, 1) || hasExtension("GL_ARB_get_program_binary")) {
+          glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+          GL_CHECK_ERROR();
+        }
+        _formats.resize(std::max(formats, 0));
+        if (formats > 0) {
+          glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, _formats.data());
+          GL_CHECK_ERROR();
+        }
+        _supported = (formats > 0);
+      }
+      return _supported;
+    };
+    uint64_t key(const ProgramSource &source) const {
+      uint64_t h = 14695981039346656037ull;
+      h = fnv1a(h, (const char *) glGetString(GL_VENDOR));
+      h = fnv1a(h, (const char *) glGetString(GL_RENDERER));
+      h = fnv1a(h, (const char *) glGetString(GL_VERSION));
+      for (size_t i = 0; i < source.stages.size(); i++) {
+        std::string text = source.source(i);
+        h = fnv1a(h, &source.stages[i].type, sizeof(GLenum));
+        h = fnv1a(h, text.data(), text.length() + 1);
+      }
+      return h;
+    };
+    /* true if the program is linked from the cached binary */
+    bool load(GLuint program, uint64_t key) {
+      std::ifstream file(path(key), std::ios::binary);
+      uint32_t magic = 0, length = 0;
+      uint64_t stored = 0;
+      GLenum format = 0;
+      file.read((char *) &magic, sizeof(magic));
+      file.read((char *) &stored, sizeof(stored));
+      file.read((char *) &format, sizeof(format));
+      file.read((char *) &length, sizeof(length));
+      if (!isSupported() || !file || magic != MAGIC || stored != key || length == 0) {
+        _statistics.misses++;
+        return false;
+      }
+      // the rest of the file has to be the binary: a truncated or corrupt header is a stale entry
+      std::streamoff header = file.tellg();
+      file.seekg(0, std::ios::end);
+      std::streamoff size = file.tellg();
+      file.seekg(header);
+      bool known = std::find(_formats.begin(), _formats.end(), (GLint) format) != _formats.end();
+      if (!known || header < 0 || size - header != (std::streamoff) length) {
+        _statistics.rejected++;
+        _statistics.misses++;
+        return false;
+      }
+      std::vector<char> binary(length);
+      file.read(binary.data(), length);
+      GLint linked = GL_FALSE;
+      if (file) {
+        // errors from before are not the binary's
+        GL_CHECK_ERROR();
+        glProgramBinary(program, format, binary.data(), (GLsizei) length);
+#ifndef OPENGL11_NO_ERROR_CHECK
+        // GL_INVALID_ENUM for the format only means the binary is stale, the link status rejects it;
+        // it is consumed from both glGetError and the debug output
+        GLenum err = glGetError();
+        if (err == GL_INVALID_ENUM) {
+          debugOutputState().pending = false;
+        } else if (err != GL_NO_ERROR) {
+          DebugOutputState &debug = debugOutputState();
+          debug.pending = false;
+          throwGLError(__FILE__, __LINE__, err, debug.enabled ? debug.message : "");
+        }
+#endif
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        GL_CHECK_ERROR();
+      }
+      if (linked == GL_FALSE) {
+        _statistics.rejected++;
+        _statistics.misses++;
+        return false;
+      }
+      _statistics.hits++;
+      return true;
+    };
+    /* write the binary of a linked program; false if the directory is not writable */
+    bool store(GLuint program, uint64_t key) {
+      GLint length = 0;
+      GLenum format = 0;
+      if (!isSupported()) {
+        return false;
+      }
+      glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+      GL_CHECK_ERROR();
+      if (length <= 0) {
+        return false;
+      }
+      std::vector<char> binary(length);
+      glGetProgramBinary(program, length, &length, &format, binary.data());
+      GL_CHECK_ERROR();
+#ifdef _WIN32
+      _mkdir(_directory.c_str());
+#else
+      mkdir(_directory.c_str(), 0755);
+#endif
+      // write to a temporary and rename, so a concurrent reader never sees half a file
+      std::string filename = path(key), temporary = filename + ".tmp";
+      std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+      uint32_t magic = MAGIC, size = (uint32_t) length;
+      file.write((const char *) &magic, sizeof(magic));
+      file.write((const char *) &key, sizeof(key));
+      file.write((const char *) &format, sizeof(format));
+      file.write((const char *) &size, sizeof(size));
+      file.write(binary.data(), length);
+      file.close();
+      if (!file || std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        return false;
+      }
+      return true;
+    };
+};
+
 class ShaderProgram {
   private:
+    struct Location {
+      std::string name;
+      GLint location, columns;
+    };
+    typedef std::unordered_map<uint32_t, Location> LocationTable;
     GLuint _id;
     int texture_unit_number;
+    LocationTable _uniformLocations, _attributeLocations, _uniformBlockIndices;
+    // stages of a submit() that has not been finished yet
+    std::vector<Shader> _stages;
+    ProgramBinaryCache *_cache;
+    uint64_t _key;
+    bool _linked;
+
+    /* register name (and "name" for arrays reported as "name[0]") */
+    static void addLocation(LocationTable &table, std::string name, GLint loc, GLint columns = 1) {
+      if (loc < 0) {
+        // members of uniform blocks, built-in variables
+        return;
+      }
+      table[hashName(name.c_str())] = Location { name, loc, columns };
+      size_t bracket = name.rfind("[0]");
+      if (bracket != std::string::npos && bracket + 3 == name.length()) {
+        name.erase(bracket);
+        table[hashName(name.c_str())] = Location { name, loc, columns };
+      }
+    };
+    /* read active uniforms & attributes once after linking */
+    void updateLocations() {
+      GLint linked = GL_FALSE, count = 0, maxLength = 0, size;
+      GLsizei length;
+      GLenum type;
+      _uniformLocations.clear();
+      _attributeLocations.clear();
+      _uniformBlockIndices.clear();
+      glGetProgramiv(_id, GL_LINK_STATUS, &linked);
+      GL_CHECK_ERROR();
+      _linked = (linked != GL_FALSE);
+      if (linked == GL_FALSE) {
+        return;
+      }
+      glGetProgramiv(_id, GL_ACTIVE_UNIFORMS, &count);
+      glGetProgramiv(_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+      GL_CHECK_ERROR();
+      std::vector<GLchar> name(maxLength + 1);
+      for (GLint i = 0; i < count; i++) {
+        glGetActiveUniform(_id, i, (GLsizei) name.size(), &length, &size, &type, name.data());
+        addLocation(_uniformLocations, std::string(name.data(), length), glGetUniformLocation(_id, name.data()));
+      }
+      GL_CHECK_ERROR();
+      glGetProgramiv(_id, GL_ACTIVE_ATTRIBUTES, &count);
+      glGetProgramiv(_id, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+      GL_CHECK_ERROR();
+      name.resize(maxLength + 1);
+      for (GLint i = 0; i < count; i++) {
+        glGetActiveAttrib(_id, i, (GLsizei) name.size(), &length, &size, &type, name.data());
+        addLocation(_attributeLocations, std::string(name.data(), length), glGetAttribLocation(_id, name.data()), columnsOfType(type));
+      }
+      GL_CHECK_ERROR();
+      glGetProgramiv(_id, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+      glGetProgramiv(_id, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+      GL_CHECK_ERROR();
+      name.resize(maxLength + 1);
+      for (GLint i = 0; i < count; i++) {
+        glGetActiveUniformBlockName(_id, i, (GLsizei) name.size(), &length, name.data());
+        addLocation(_uniformBlockIndices, std::string(name.data(), length), i);
+      }
+      GL_CHECK_ERROR();
+    };
   public:
-    ShaderProgram() : _id(0), texture_unit_number(0) {};
+    ShaderProgram() : _id(0), texture_unit_number(0), _cache(NULL), _key(0), _linked(false) {};
     ~ShaderProgram() { release(); };
+    /* the location tables move with the name */
+    ShaderProgram(const ShaderProgram&) = delete;
+    ShaderProgram& operator=(const ShaderProgram&) = delete;
+    ShaderProgram(ShaderProgram &&other)
+      : _id(other._id), texture_unit_number(0), _uniformLocations(std::move(other._uniformLocations)),
+        _attributeLocations(std::move(other._attributeLocations)), _uniformBlockIndices(std::move(other._uniformBlockIndices)),
+        _stages(std::move(other._stages)), _cache(other._cache), _key(other._key), _linked(other._linked) {
+      other._id = 0;
+      other._stages.clear();
+      other._linked = false;
+    };
+    ShaderProgram& operator=(ShaderProgram &&other) {
+      if (this != &other) {
+        release();
+        _id = other._id;
+        texture_unit_number = 0;
+        _uniformLocations = std::move(other._uniformLocations);
+        _attributeLocations = std::move(other._attributeLocations);
+        _uniformBlockIndices = std::move(other._uniformBlockIndices);
+        _stages = std::move(other._stages);
+        _cache = other._cache;
+        _key = other._key;
+        _linked = other._linked;
+        other._id = 0;
+        other._stages.clear();
+        other._linked = false;
+      }
+      return *this;
+    };
     GLuint id() {
       return _id;
     };
@@ -669,89 +2958,155 @@ class ShaderProgram {
       GL_CHECK_ERROR();
     };
     void release() {
-      glDeleteProgram(_id);
-      GL_CHECK_ERROR();
+      StateCache::current().deleteProgram(_id);
     };
     void bind() {
       texture_unit_number = 0;
       if (!isCreated()) {
         create();
       }
-      glUseProgram(_id);
-      GL_CHECK_ERROR();
+      StateCache::current().useProgram(_id);
     };
     void unbind() {
-      glUseProgram(0);
+      StateCache::current().useProgram(0);
+    };
+    /* locations are looked up in the table filled by link(); inactive names give -1 as glGet*Location does */
+    GLint uniformLocation(Name name) {
+      LocationTable::const_iterator it = _uniformLocations.find(name.hash);
+      if (it == _uniformLocations.end()) {
+        return -1;
+      }
+      if (it->second.name != name.str) {
+        // hash collision
+        return glGetUniformLocation(_id, name.str);
+      }
+      return it->second.location;
+    };
+    GLint attributeLocation(Name name) {
+      LocationTable::const_iterator it = _attributeLocations.find(name.hash);
+      if (it == _attributeLocations.end()) {
+        return -1;
+      }
+      if (it->second.name != name.str) {
+        return glGetAttribLocation(_id, name.str);
+      }
+      return it->second.location;
+    };
+    /* matrix attributes take one location per column */
+    GLint attributeColumns(Name name) {
+      LocationTable::const_iterator it = _attributeLocations.find(name.hash);
+      if (it == _attributeLocations.end() || it->second.name != name.str) {
+        return 1;
+      }
+      return it->second.columns;
+    };
+    GLuint uniformBlockIndex(Name name) {
+      LocationTable::const_iterator it = _uniformBlockIndices.find(name.hash);
+      if (it == _uniformBlockIndices.end()) {
+        return GL_INVALID_INDEX;
+      }
+      if (it->second.name != name.str) {
+        return glGetUniformBlockIndex(_id, name.str);
+      }
+      return it->second.location;
+    };
+    /* assign a binding point to a uniform block; this is a part of the program state, set it once after linking */
+    void setUniformBlockBinding(Name blockName, GLuint binding) {
+      GLuint index = uniformBlockIndex(blockName);
+      if (index == GL_INVALID_INDEX) {
+        return;
+      }
+      glUniformBlockBinding(_id, index, binding);
       GL_CHECK_ERROR();
     };
-    void setAttributeBuffer(const char * name, GLenum type, const intptr_t offset, GLsizei tuple) {
+    /* matrix attributes read `tuple` components per vertex/instance, split evenly into their columns */
+    void setAttributeBuffer(Name name, GLenum type, const intptr_t offset, GLsizei tuple, GLuint divisor = 0) {
       if (!isCreated()) {
         create();
       }
-      glVertexAttribPointer(glGetAttribLocation(_id, name), tuple, type, GL_TRUE, 0, (GLvoid *) offset);
-      GL_CHECK_ERROR();
+      GLint loc = attributeLocation(name), columns = attributeColumns(name);
+      // removed by the linker (unused in the shader)
+      if (loc < 0) {
+        return;
+      }
+      GLsizei stride = (columns > 1) ? tuple * sizeOfDataType(type) : 0;
+      for (GLint i = 0; i < columns; i++) {
+        StateCache::current().vertexAttribPointer(loc + i, tuple / columns, type, GL_TRUE, stride, offset + i * (tuple / columns) * sizeOfDataType(type));
+        StateCache::current().vertexAttribDivisor(loc + i, divisor);
+      }
     };
-    void setUniformValue (const char * name, Texture2D &texture) {
-        int max_texture_units;
-        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_texture_units);
-        GL_CHECK_ERROR();
+    /* bind to the next texture unit; without a sampler the texture parameters apply */
+    void setUniformValue (Name name, Texture2D &texture, Sampler *sampler = NULL) {
+        int max_texture_units = StateCache::current().maxTextureImageUnits();
         if (texture_unit_number >= max_texture_units) {
           std::stringstream error;
           error << "Cannot bind more than " << max_texture_units << " textures at one time";
           throw std::runtime_error(error.str());
         }
-        glActiveTexture(GL_TEXTURE0 + texture_unit_number);
-        GL_CHECK_ERROR();
+        StateCache::current().activeTexture(GL_TEXTURE0 + texture_unit_number);
         texture.bind();
+        if (sampler) {
+          sampler->bind(texture_unit_number);
+        } else {
+          StateCache::current().bindSampler(texture_unit_number, 0);
+        }
         setUniformValue(name, texture_unit_number);
         texture_unit_number++;
     };
+    void setUniformValue (Name name, Texture2D &texture, Sampler &sampler) {
+        setUniformValue(name, texture, &sampler);
+    };
     template <typename... Args>
       void bind(VertexArray &vao, Args&&... args) {
         vao.bind();
         bind(args ...);
       };
+    template <typename... Args>
+      void bind(Name name, Texture2D& texture, Sampler& sampler, Args&&... args) {
+        bind(args ...);
+        setUniformValue(name, texture, sampler);
+      }
     template <typename... Args, typename T>
-      void bind(const char * name, Buffer<T>& buf, const intptr_t offset, Args&&... args) {
+      void bind(Name name, Buffer<T>& buf, const intptr_t offset, Args&&... args) {
         bind(args ...);
         buf.bind();
         enableAttributeArray(name);
-        setAttributeBuffer(name, buf.dataType(), offset, buf.tupleSize());
+        setAttributeBuffer(name, buf.dataType(), offset, buf.tupleSize(), buf.divisor());
       }
     template <typename... Args, typename T>
-      void bind(const char * name, Buffer<T>& buf, Args&&... args) {
+      void bind(Name name, Buffer<T>& buf, Args&&... args) {
         bind(args ...);
         buf.bind();
         enableAttributeArray(name);
-        setAttributeBuffer(name, buf.dataType(), 0, buf.tupleSize());
+        setAttributeBuffer(name, buf.dataType(), 0, buf.tupleSize(), buf.divisor());
       }
     template <typename... Args>
-      void bind(const char * name, const GLfloat x, const GLfloat y, const GLfloat z, const GLfloat w, Args&&... args) {
+      void bind(Name name, const GLfloat x, const GLfloat y, const GLfloat z, const GLfloat w, Args&&... args) {
         bind(args ...);
         setUniformValue(name, x, y, z, w);
       }
     template <typename... Args>
-      void bind(const char * name, const GLfloat x, const GLfloat y, const GLfloat z, Args&&... args) {
+      void bind(Name name, const GLfloat x, const GLfloat y, const GLfloat z, Args&&... args) {
         bind(args ...);
         setUniformValue(name, x, y, z);
       }
     template <typename... Args>
-      void bind(const char * name, const GLfloat x, const GLfloat y, Args&&... args) {
+      void bind(Name name, const GLfloat x, const GLfloat y, Args&&... args) {
         bind(args ...);
         setUniformValue(name, x, y);
       }
     template <typename T, typename... Args>
-      void bind(const char * name, const T *value, int count, int tuple, Args&&... args) {
+      void bind(Name name, const T *value, int count, int tuple, Args&&... args) {
         bind(args ...);
         setUniformValueArray(name, value, count, tuple);
       }
     template <typename T, typename... Args>
-      void bind(const char * name, const T *value, int count, Args&&... args) {
+      void bind(Name name, const T *value, int count, Args&&... args) {
         bind(args ...);
         setUniformValue(name, value, count);
       }
     template <typename T, typename... Args>
-      void bind(const char * name, T& value, Args&&... args) {
+      void bind(Name name, T& value, Args&&... args) {
         bind(args ...);
         setUniformValue(name, value);
       };
@@ -775,6 +3130,7 @@ class ShaderProgram {
       }
       glLinkProgram(_id);
       GL_CHECK_ERROR();
+      updateLocations();
     };
 
     template <typename... Args>
@@ -786,26 +3142,7 @@ class ShaderProgram {
     template <typename... Args>
       void link(const char* filename, Args&&... args) {
         std::cout << "compiling: " << filename << std::endl;
-        GLenum type;
-        std::string s_filename = filename, extension = "";
-        if (s_filename.find_last_of(".") != std::string::npos) {
-          extension = s_filename.substr(s_filename.find_last_of("."));
-        }
-        if (extension == ".vert" || extension == ".glslv") {
-          type = GL_VERTEX_SHADER;
-        } else if (extension == ".tesc" || extension == ".tsc") {
-          type = GL_TESS_CONTROL_SHADER;
-        } else if (extension == ".tese" || extension == ".tse") {
-          type = GL_TESS_EVALUATION_SHADER;
-        } else if (extension == ".geom" || extension == ".glslg") {
-          type = GL_GEOMETRY_SHADER;
-        } else if (extension == ".frag" || extension == ".glslf") {
-          type = GL_FRAGMENT_SHADER;
-        } else if (extension == ".comp"|| extension == ".glslc") {
-          type = GL_COMPUTE_SHADER;
-        } else {
-          throw std::runtime_error("cannot detect the shader type of: " + s_filename);
-        }
+        GLenum type = shaderTypeOf(filename);
         Shader s(type);
         s.compileFromSourceFile(filename);
         link(s, args...);
@@ -816,24 +3153,130 @@ class ShaderProgram {
         link(args ...);
         detach(s);
       };
+    /*
+     * link from the binary cache, or compile the sources and store the binary
+     *   submit()          starts compiling and linking without querying any status
+     *   isLinkComplete()  non-blocking with KHR_parallel_shader_compile, see ShaderCompiler
+     *   finish()          waits, throws if a stage or the program failed, stores the binary
+     */
+    void submit(ProgramBinaryCache &cache, const ProgramSource &source) {
+      if (!isCreated()) {
+        create();
+      }
+      _cache = &cache;
+      _key = cache.key(source);
+      _linked = false;
+      for (size_t i = 0; i < _stages.size(); i++) {
+        detach(_stages[i]);
+      }
+      _stages.clear();
+      if (cache.load(_id, _key)) {
+        updateLocations();
+        return;
+      }
+      if (cache.isSupported()) {
+        glProgramParameteri(_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        GL_CHECK_ERROR();
+      }
+      _stages.reserve(source.stages.size());
+      for (size_t i = 0; i < source.stages.size(); i++) {
+        std::cout << "compiling: " << source.stages[i].filename << std::endl;
+        // only attached stages are kept, they are the ones to detach if this throws
+        Shader stage(source.stages[i].type);
+        stage.setSourceString(source.source(i));
+        stage.submit();
+        attach(stage);
+        _stages.push_back(std::move(stage));
+      }
+      glLinkProgram(_id);
+      GL_CHECK_ERROR();
+    };
+    bool isPending() {
+      return !_stages.empty();
+    };
+    /* always true without KHR_parallel_shader_compile, finish() then waits */
+    bool isLinkComplete() {
+      GLint complete = GL_TRUE;
+      if (!_stages.empty() && StateCache::current().hasParallelShaderCompile()) {
+        glGetProgramiv(_id, GL_COMPLETION_STATUS_KHR, &complete);
+        GL_CHECK_ERROR();
+      }
+      return complete != GL_FALSE;
+    };
+    void finish() {
+      if (_stages.empty()) {
+        return;
+      }
+      std::vector<Shader> stages(std::move(_stages));
+      _stages.clear();
+      GLint linked = GL_FALSE;
+      glGetProgramiv(_id, GL_LINK_STATUS, &linked);
+      GL_CHECK_ERROR();
+      if (linked == GL_FALSE) {
+        for (size_t i = 0; i < stages.size(); i++) {
+          if (!stages[i].compileStatus()) {
+            std::cout << stages[i].infolog() << std::endl;
+          }
+        }
+        std::cout << infolog() << std::endl;
+      }
+      // also on failure, or the next submit() links the failed stages again
+      for (size_t i = 0; i < stages.size(); i++) {
+        detach(stages[i]);
+      }
+      if (linked == GL_FALSE) {
+        throw std::runtime_error("program link failed");
+      }
+      updateLocations();
+      _cache->store(_id, _key);
+    };
+    /* linked and not waiting for a submit() */
+    bool isReady() {
+      return _linked && _stages.empty();
+    };
+    void link(ProgramBinaryCache &cache, const ProgramSource &source) {
+      submit(cache, source);
+      finish();
+    };
+    template <typename... Args>
+      void link(ProgramBinaryCache &cache, const char* filename, Args&&... args) {
+        link(cache, ProgramSource(filename, args...));
+      };
+    std::string infolog() {
+      GLint len = 0;
+      GLsizei written = 0;
+      glGetProgramiv(_id, GL_INFO_LOG_LENGTH, &len);
+      GL_CHECK_ERROR();
+      if (len <= 0) {
+        return "";
+      }
+      std::vector<GLchar> log(len);
+      glGetProgramInfoLog(_id, len, &written, log.data());
+      GL_CHECK_ERROR();
+      return std::string(log.data(), written);
+    };
 
     void enableAttributeArray(GLuint loc) {
-      glEnableVertexAttribArray(loc);
-      GL_CHECK_ERROR();
+      StateCache::current().enableVertexAttribArray(loc);
     };
-    void enableAttributeArray(const char *locName) {
+    void enableAttributeArray(Name locName) {
       if (!isCreated()) {
         create();
       }
-      glEnableVertexAttribArray(glGetAttribLocation(_id, locName));
-      GL_CHECK_ERROR();
+      GLint loc = attributeLocation(locName), columns = attributeColumns(locName);
+      if (loc < 0) {
+        return;
+      }
+      for (GLint i = 0; i < columns; i++) {
+        StateCache::current().enableVertexAttribArray(loc + i);
+      }
     };
     template <typename... Args>
-      void setUniformValue (const char *locName, Args&&... args) {
+      void setUniformValue (Name locName, Args&&... args) {
        if (!isCreated()) {
          create();
        }
-       setUniformValue((GLuint) glGetUniformLocation(_id, locName), args...);
+       setUniformValue((GLuint) uniformLocation(locName), args...);
       };
 #ifdef USE_ARMADILLO
     inline void setUniformValue (GLuint loc, const fvec1& s) { glUniform1fv(loc, 1, (GLfloat *) s.memptr()); GL_CHECK_ERROR(); };
@@ -868,5 +3311,169 @@ class ShaderProgram {
     inline void setUniformValue (GLuint loc, GLint s, GLint t, GLint u) { glUniform3i(loc, s, t, u); GL_CHECK_ERROR(); };
     inline void setUniformValue (GLuint loc, GLint s, GLint t, GLint u, GLint v) { glUniform4i(loc, s, t, u, v); GL_CHECK_ERROR(); };
 };
+
+/*
+ * programs submitted together and finished over the following frames
+ *   submit() everything at startup, then poll() once per frame and draw with a fallback
+ *   until ShaderProgram::isReady(). with KHR_parallel_shader_compile poll() never waits;
+ *   without it, one program is finished per poll() so the status queries are spread out.
+ *   reload() recompiles the programs that read any of the changed files into a new program
+ *   and moves it over the old one when it is done; a reload that fails keeps the old program.
+ * the programs must not move while they are pending, and must be forget()-ed before reload()
+ * if they are destroyed first.
+ */
+class ShaderCompiler {
+  private:
+    struct Job {
+      ShaderProgram *target;
+      // the replacement built by reload(), NULL when target itself is compiling
+      std::unique_ptr<ShaderProgram> staging;
+    };
+    ProgramBinaryCache &_cache;
+    std::deque<Job> _pending;
+    std::unordered_map<ShaderProgram *, ProgramSource> _sources;
+
+    void cancel(ShaderProgram &program) {
+      for (size_t i = 0; i < _pending.size();) {
+        if (_pending[i].target == &program) {
+          _pending.erase(_pending.begin() + i);
+        } else {
+          i++;
+        }
+      }
+    };
+    void finish(Job &job) {
+      if (!job.staging) {
+        job.target->finish();
+        return;
+      }
+      try {
+        job.staging->finish();
+      } catch (std::exception &e) {
+        std::cout << "reload failed: " << e.what() << std::endl;
+        return;
+      }
+      *job.target = std::move(*job.staging);
+    };
+  public:
+    ShaderCompiler(ProgramBinaryCache &cache) : _cache(cache) {};
+    ShaderCompiler(const ShaderCompiler&) = delete;
+    ShaderCompiler& operator=(const ShaderCompiler&) = delete;
+    ProgramBinaryCache& cache() {
+      return _cache;
+    };
+    bool hasParallelCompile() {
+      return StateCache::current().hasParallelShaderCompile();
+    };
+    void submit(ShaderProgram &program, const ProgramSource &source) {
+      cancel(program);
+      _sources[&program] = source;
+      program.submit(_cache, source);
+      if (program.isPending()) {
+        _pending.push_back(Job { &program, std::unique_ptr<ShaderProgram>() });
+      }
+    };
+    template <typename... Args>
+      void submit(ShaderProgram &program, const char* filename, Args&&... args) {
+        submit(program, ProgramSource(filename, args...));
+      };
+    void forget(ShaderProgram &program) {
+      cancel(program);
+      _sources.erase(&program);
+    };
+    /* resubmit the programs reading any of files; returns their number */
+    size_t reload(const std::vector<std::string> &files) {
+      size_t count = 0;
+      for (auto it = _sources.begin(); it != _sources.end(); ++it) {
+        ProgramSource &source = it->second;
+        if (!source.reads(files)) {
+          continue;
+        }
+        ShaderProgram &program = *it->first;
+        cancel(program);
+        // staged even if the program never linked, so a failure is reported here and not by poll()
+        Job job = { &program, std::unique_ptr<ShaderProgram>(new ShaderProgram()) };
+        try {
+          source.reload();
+          job.staging->submit(_cache, source);
+        } catch (std::exception &e) {
+          std::cout << "reload failed: " << e.what() << std::endl;
+          continue;
+        }
+        count++;
+        if (job.staging->isPending()) {
+          _pending.push_back(std::move(job));
+        } else {
+          // linked from the binary cache
+          program = std::move(*job.staging);
+        }
+      }
+      return count;
+    };
+    /* finish the programs that are done; returns the number still pending */
+    size_t poll() {
+      if (hasParallelCompile()) {
+        for (size_t i = 0; i < _pending.size();) {
+          ShaderProgram &program = _pending[i].staging ? *_pending[i].staging : *_pending[i].target;
+          if (program.isLinkComplete()) {
+            Job job = std::move(_pending[i]);
+            _pending.erase(_pending.begin() + i);
+            finish(job);
+          } else {
+            i++;
+          }
+        }
+      } else if (!_pending.empty()) {
+        // submitted first, most likely done
+        Job job = std::move(_pending.front());
+        _pending.pop_front();
+        finish(job);
+      }
+      return _pending.size();
+    };
+    void finish() {
+      while (!_pending.empty()) {
+        Job job = std::move(_pending.front());
+        _pending.pop_front();
+        finish(job);
+      }
+    };
+    size_t pending() const {
+      return _pending.size();
+    };
+};
+
+/*
+ * variants of one program specialized by #defines, built on first use
+ *   ProgramPermutations lit(compiler, "lit.vert", "lit.frag");
+ *   ShaderProgram &p = lit.get({{"SHADOWS", "1"}});
+ * the sources are read once; every variant goes through the compiler (and its binary cache).
+ */
+class ProgramPermutations {
+  private:
+    ShaderCompiler &_compiler;
+    ProgramSource _source;
+    std::unordered_map<std::string, std::unique_ptr<ShaderProgram>> _programs;
+  public:
+    template <typename... Args>
+      ProgramPermutations(ShaderCompiler &compiler, const char* filename, Args&&... args)
+        : _compiler(compiler), _source(filename, args...) {};
+    ProgramPermutations(const ProgramPermutations&) = delete;
+    ProgramPermutations& operator=(const ProgramPermutations&) = delete;
+    /* submitted to the compiler when new; draw only once isReady() */
+    ShaderProgram& get(const DefineSet &defines) {
+      ProgramSource source = _source;
+      source.define(defines);
+      std::unique_ptr<ShaderProgram> &program = _programs[source.defines];
+      if (!program) {
+        program.reset(new ShaderProgram());
+        _compiler.submit(*program, source);
+      }
+      return *program;
+    };
+    size_t size() const {
+      return _programs.size();
+    };
+};
 };
 #endif
@@ -0,0 +1,94 @@
+#include "Animation.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+constexpr float Animation::DEFAULT_NLERP_THRESHOLD;
+
+void Animation::Batch::clear() {
+  a.resize(0), b.resize(0), theta.clear(), u.clear(), tracks.clear();
+}
+
+void Animation::Batch::push_back(size_t track, const geom::fquaternion &qa, const geom::fquaternion &qb, float angle, float t) {
+  a.push_back(qa), b.push_back(qb), theta.push_back(angle), u.push_back(t), tracks.push_back(track);
+}
+
+size_t Animation::addTrack(const std::vector<Key> &keys, bool loop) {
+  if (keys.empty()) {
+    throw std::logic_error("Animation::addTrack: no keys");
+  }
+  size_t first = _times.size();
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (i && keys[i].time <= keys[i - 1].time) {
+      throw std::logic_error("Animation::addTrack: key times have to ascend");
+    }
+    geom::ftransform key = keys[i].transform;
+    if (i) {
+      // q and -q are the same rotation; take the one on the short way from the previous key
+      geom::fquaternion p = _keys.rot.get(first + i - 1);
+      float dot = p.w * key.rot.w + p.x * key.rot.x + p.y * key.rot.y + p.z * key.rot.z;
+      if (dot < 0.0f) {
+        key.rot = -key.rot;
+        dot = -dot;
+      }
+      float angle = std::acos(std::min(dot, 1.0f));
+      // the rotations differ by twice the angle of the quaternions
+      _angles.back() = 2.0f * angle < _nlerpThreshold ? 0.0f : angle;
+    }
+    _times.push_back(keys[i].time);
+    _keys.push_back(key);
+    _angles.push_back(0.0f);
+  }
+  _first.push_back(first);
+  _count.push_back(keys.size());
+  _loop.push_back(loop);
+  _segment.push_back(first);
+  return size() - 1;
+}
+
+// the key starting the segment that contains time, time within the keys of the track
+size_t Animation::findSegment(size_t track, float time) {
+  size_t first = _first[track], last = first + _count[track] - 1;
+  size_t k = _segment[track];
+  // mostly time moves forward within the segment or into the next one
+  for (size_t steps = 0; steps < 2 && k < last; steps++, k++) {
+    if (_times[k] <= time && time < _times[k + 1]) {
+      return _segment[track] = k;
+    }
+  }
+  k = std::upper_bound(_times.begin() + first, _times.begin() + last, time) - _times.begin();
+  return _segment[track] = std::max(k, first + 1) - 1;
+}
+
+const geom::ftransform_soa &Animation::sample(float time) {
+  _out.resize(size());
+  _nlerp.clear();
+  _slerp.clear();
+  for (size_t track = 0; track < size(); track++) {
+    size_t first = _first[track], last = first + _count[track] - 1;
+    float start = _times[first], end = _times[last], t = time;
+    if (_loop[track] && end > start) {
+      t = start + std::fmod(t - start, end - start);
+      t = t < start ? t + (end - start) : t;
+    }
+    if (t <= start || t >= end) {
+      _out.set(track, _keys.get(t <= start ? first : last));
+      continue;
+    }
+    size_t k = findSegment(track, t);
+    float u = (t - _times[k]) / (_times[k + 1] - _times[k]);
+    _out.x[track] = _keys.x[k] + u * (_keys.x[k + 1] - _keys.x[k]);
+    _out.y[track] = _keys.y[k] + u * (_keys.y[k + 1] - _keys.y[k]);
+    _out.z[track] = _keys.z[k] + u * (_keys.z[k + 1] - _keys.z[k]);
+    _out.scale[track] = _keys.scale[k] + u * (_keys.scale[k + 1] - _keys.scale[k]);
+    (_angles[k] ? _slerp : _nlerp).push_back(track, _keys.rot.get(k), _keys.rot.get(k + 1), _angles[k], u);
+  }
+  geom::nlerp(_nlerp.a, _nlerp.b, _nlerp.u, _nlerp.out);
+  geom::slerp(_slerp.a, _slerp.b, _slerp.theta, _slerp.u, _slerp.out);
+  for (const Batch *batch : { &_nlerp, &_slerp }) {
+    for (size_t i = 0; i < batch->tracks.size(); i++) {
+      _out.rot.set(batch->tracks[i], batch->out.get(i));
+    }
+  }
+  return _out;
+}
@@ -0,0 +1,69 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "geom.h"
+#include "geom_soa.h"
+
+/*
+ * keyframe tracks, all sampled at once:
+ *
+ *   a track animates one transform (position, rotation, scale) over its keys. Between two keys
+ *   position and scale are interpolated linearly and rotation by slerp, or by nlerp where the
+ *   rotations of the keys differ by less than the nlerp threshold (radians) and nlerp is as
+ *   accurate. The angle of every segment is computed once, in addTrack().
+ *
+ *   sample() looks up the segment of each track starting from the one of the previous call,
+ *   then interpolates the rotations of all tracks with the batch kernels of geom_soa.h.
+ */
+class Animation {
+public:
+  // nlerp and slerp differ by less than 1e-6 rad below this angle
+  static constexpr float DEFAULT_NLERP_THRESHOLD = 0.05f;
+
+  struct Key {
+    float time;
+    geom::ftransform transform;
+  };
+
+  explicit Animation(float nlerpThreshold = DEFAULT_NLERP_THRESHOLD) : _nlerpThreshold(nlerpThreshold) {}
+
+  // keys in ascending time; loop: repeat from the first key after the last one, otherwise hold it.
+  // returns the index of the track in sample()
+  size_t addTrack(const std::vector<Key> &keys, bool loop);
+  size_t size() const { return _first.size(); }
+
+  // transform i of the result is track i at time (seconds)
+  const geom::ftransform_soa &sample(float time);
+  // tracks interpolated by nlerp and by slerp in the last sample()
+  size_t nlerpCount() const { return _nlerp.tracks.size(); }
+  size_t slerpCount() const { return _slerp.tracks.size(); }
+
+private:
+  // rotations of one interpolation method, gathered from the tracks
+  struct Batch {
+    geom::fquaternion_soa a, b, out;
+    std::vector<float> theta, u;
+    std::vector<size_t> tracks;
+    void clear();
+    void push_back(size_t track, const geom::fquaternion &qa, const geom::fquaternion &qb, float angle, float t);
+  };
+
+  float _nlerpThreshold;
+  // keys of all tracks; track i owns [_first[i], _first[i] + _count[i])
+  std::vector<float> _times;
+  geom::ftransform_soa _keys;
+  // angle between the rotations of key k and k + 1 as quaternions, 0 where nlerp is used
+  std::vector<float> _angles;
+  std::vector<size_t> _first, _count;
+  std::vector<uint8_t> _loop;
+  // key starting the segment of the previous sample(), per track
+  std::vector<size_t> _segment;
+  Batch _nlerp, _slerp;
+  geom::ftransform_soa _out;
+
+  size_t findSegment(size_t track, float time);
+};
+
+#endif // ANIMATION_H
@@ -0,0 +1,208 @@
+#include "CompiledScene.h"
+#include "geom.h"
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+size_t CompiledScene::size() const {
+  size_t n = 0;
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    n += primitives[type].size();
+  }
+  return n;
+}
+
+size_t CompiledScene::update(std::vector<InstanceRange> &moved) {
+  size_t count = graph.update();
+  for (const SceneGraph::Range &range : graph.updated()) {
+    for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+      PrimitiveArrays &arrays = primitives[type];
+      // primitives are numbered in depth-first order, so a subtree is one run per type
+      size_t first = std::lower_bound(arrays.nodes.begin(), arrays.nodes.end(), range.first) - arrays.nodes.begin();
+      size_t last = std::lower_bound(arrays.nodes.begin() + first, arrays.nodes.end(), range.last) - arrays.nodes.begin();
+      if (first == last) {
+        continue;
+      }
+      for (size_t i = first; i < last; i++) {
+        geom::ftransform world = graph.world(arrays.nodes[i]);
+        const float *local = &arrays.localBounds[4 * i];
+        geom::to_matrix(world, &arrays.models[16 * i]);
+        arrays.bounds.set(i, world * geom::fquaternion(0.0f, local[0], local[1], local[2]), std::fabs(world.scale) * local[3]);
+      }
+      if (!moved.empty() && moved.back().type == type && moved.back().first + moved.back().count == first) {
+        moved.back().count += last - first;
+      } else {
+        moved.push_back(InstanceRange { (Primitive) type, first, last - first });
+      }
+    }
+  }
+  return count;
+}
+
+size_t CompiledScene::cull(const float *viewProjection, size_t gap, std::vector<InstanceRange> &visible) {
+  float planes[24];
+  geom::frustum_planes(viewProjection, planes);
+  size_t count = 0;
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    geom::plane_distances(primitives[type].bounds, planes, 6, distances);
+    for (size_t i = 0; i < distances.size(); i++) {
+      if (distances[i] < 0.0f) {
+        continue;
+      }
+      count++;
+      if (!visible.empty() && visible.back().type == type && visible.back().first + visible.back().count + gap >= i) {
+        visible.back().count = i + 1 - visible.back().first;
+      } else {
+        visible.push_back(InstanceRange { (Primitive) type, i, 1 });
+      }
+    }
+  }
+  return count;
+}
+
+void CompiledScene::animate(float time) {
+  if (!animation.size()) {
+    return;
+  }
+  const geom::ftransform_soa &transforms = animation.sample(time);
+  for (size_t i = 0; i < animated.size(); i++) {
+    graph.setLocal(animated[i], transforms.get(i));
+  }
+}
+
+static geom::ftransform groupTransform(const YAML::Node &node) {
+  geom::ftransform t = geom::translate(node["position"].as<std::vector<float>>());
+  if (node["rotation"]) {
+    std::vector<float> r = node["rotation"].as<std::vector<float>>();
+    t = t * geom::rotate(r.at(0), r.at(1), r.at(2));
+  }
+  if (node["scale"]) {
+    t = t * geom::scale(node["scale"].as<float>());
+  }
+  return t;
+}
+
+/*
+ * bounding sphere (x, y, z, radius) in model space of the strip helix.vert generates from param.
+ * The strip runs over x in [0, 2 angle] (helix) or [0, 2 len] (line, clothoid) and y in [0, 1].
+ */
+static std::array<float, 4> primitiveBounds(Primitive type, const std::array<float, 4> &param) {
+  std::array<float, 3> lo, hi;
+  switch (type) {
+    case HELIX: {
+      // (r cos x, r x tan(helix_angle) + width y, r sin x)
+      float r = std::fabs(param[0]), width = param[1], rise = 2.0f * param[2] * param[0] * std::tan(param[3]);
+      lo = {{ -r, std::min(rise, 0.0f) + std::min(width, 0.0f), -r }};
+      hi = {{ r, std::max(rise, 0.0f) + std::max(width, 0.0f), r }};
+      break;
+    }
+    case LINE: {
+      // (x, 0, width y)
+      float width = param[0], len = 2.0f * param[1];
+      lo = {{ std::min(len, 0.0f), 0.0f, std::min(width, 0.0f) }};
+      hi = {{ std::max(len, 0.0f), 0.0f, std::max(width, 0.0f) }};
+      break;
+    }
+    default: {
+      // every term of the series in x, p = a x and q = slope_a x bounded by its absolute value,
+      // |p| <= 2 sqrt(angle), |q| <= 2 sqrt(slope_angle)
+      float width = std::fabs(param[0]), x = 2.0f * std::fabs(param[3]);
+      float p = 2.0f * std::sqrt(std::fabs(param[1])), q = 2.0f * std::sqrt(std::fabs(param[2]));
+      hi = {{ x * (1.0f + std::pow(p, 4.0f) / 10.0f + std::pow(p, 8.0f) / 216.0f) + width,
+              x * (q * q / 3.0f + std::pow(q, 7.0f) / 42.0f),
+              x * (p * p / 3.0f + std::pow(p, 7.0f) / 42.0f) + width }};
+      lo = {{ -hi[0], -hi[1], -hi[2] }};
+    }
+  }
+  float radius = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    radius += (hi[i] - lo[i]) * (hi[i] - lo[i]) / 4.0f;
+  }
+  return {{ (lo[0] + hi[0]) / 2.0f, (lo[1] + hi[1]) / 2.0f, (lo[2] + hi[2]) / 2.0f, std::sqrt(radius) }};
+}
+
+static void compileAnimation(const YAML::Node &node, SceneGraph::Node target, CompiledScene &scene) {
+  if (!node) {
+    return;
+  }
+  std::vector<Animation::Key> keys;
+  for (size_t i = 0; i < node["keys"].size(); i++) {
+    YAML::Node key = node["keys"][i];
+    keys.push_back(Animation::Key { key["time"].as<float>(), groupTransform(key) });
+  }
+  scene.animation.addTrack(keys, node["loop"] && node["loop"].as<bool>());
+  scene.animated.push_back(target);
+}
+
+static void compileNodes(const YAML::Node &sceneNode, SceneGraph::Node parent, CompiledScene &scene) {
+  for (size_t i = 0; i < sceneNode.size(); i++) {
+    YAML::Node node_type = sceneNode[i];
+    YAML::Node node;
+    Primitive type;
+    std::array<float, 4> param = {{ 0.0f, 0.0f, 0.0f, 0.0f }};
+    if (node_type["helix"]) {
+      node = node_type["helix"];
+      type = HELIX;
+      param = {{ node["r"].as<float>(), node["width"].as<float>(), node["angle"].as<float>(), node["helix_angle"].as<float>() }};
+    } else if (node_type["line"]) {
+      node = node_type["line"];
+      type = LINE;
+      param = {{ node["width"].as<float>(), node["len"].as<float>(), 0.0f, 0.0f }};
+    } else if (node_type["clothoid"]) {
+      node = node_type["clothoid"];
+      type = CLOTHOID;
+      param = {{ node["width"].as<float>(), node["angle"].as<float>(), node["slope_angle"].as<float>(), node["len"].as<float>() }};
+    } else if (node_type["group"]) {
+      node = node_type["group"];
+      SceneGraph::Node group = scene.graph.add(parent, groupTransform(node));
+      compileAnimation(node["animation"], group, scene);
+      compileNodes(node["children"], group, scene);
+      continue;
+    } else {
+      continue;
+    }
+    PrimitiveArrays &arrays = scene.primitives[type];
+    arrays.nodes.push_back(scene.graph.add(parent, geom::translate(node["position"].as<std::vector<float>>())));
+    compileAnimation(node["animation"], arrays.nodes.back(), scene);
+    arrays.models.resize(arrays.models.size() + 16);
+    arrays.params.insert(arrays.params.end(), param.begin(), param.end());
+    std::array<float, 4> bounds = primitiveBounds(type, param);
+    arrays.localBounds.insert(arrays.localBounds.end(), bounds.begin(), bounds.end());
+  }
+}
+
+CompiledScene compileScene(const YAML::Node &sceneNode) {
+  CompiledScene scene;
+  compileNodes(sceneNode, SceneGraph::NONE, scene);
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    scene.primitives[type].bounds.resize(scene.primitives[type].size());
+  }
+  // every node is new: this fills the models and bounds
+  std::vector<InstanceRange> moved;
+  scene.update(moved);
+  return scene;
+}
+
+bool diffScenes(const CompiledScene &from, const CompiledScene &to, std::vector<InstanceRange> &changed) {
+  changed.clear();
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    if (from.primitives[type].size() != to.primitives[type].size()) {
+      return false;
+    }
+  }
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    const PrimitiveArrays &a = from.primitives[type], &b = to.primitives[type];
+    for (size_t i = 0; i < a.size(); i++) {
+      if (std::equal(&a.models[16 * i], &a.models[16 * i] + 16, &b.models[16 * i]) &&
+          std::equal(&a.params[4 * i], &a.params[4 * i] + 4, &b.params[4 * i])) {
+        continue;
+      }
+      if (!changed.empty() && changed.back().type == type && changed.back().first + changed.back().count == i) {
+        changed.back().count++;
+      } else {
+        changed.push_back(InstanceRange { (Primitive) type, i, 1 });
+      }
+    }
+  }
+  return true;
+}
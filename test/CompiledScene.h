@@ -0,0 +1,71 @@
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+#include <vector>
+#include <cstddef>
+#include <yaml-cpp/yaml.h>
+#include "SceneGraph.h"
+#include "Animation.h"
+#include "geom_soa.h"
+
+// primitive types of scene.yaml, numbered as PRIMITIVE in helix.vert
+enum Primitive { LINE = 0, HELIX = 1, CLOTHOID = 2, PRIMITIVE_TYPES };
+
+// the primitives of one type as structure of arrays, laid out as the instance attributes of helix.vert
+struct PrimitiveArrays {
+  // column-major model matrices, 16 floats per primitive
+  std::vector<float> models;
+  // shape parameters, 4 floats per primitive:
+  //   helix (r, width, angle, helix_angle), line (width, len, 0, 0), clothoid (width, angle, slope_angle, len)
+  std::vector<float> params;
+  // scene graph node of each primitive, ascending; models holds their world transforms
+  std::vector<SceneGraph::Node> nodes;
+  // bounding sphere of each primitive in model space (x, y, z, radius), 4 floats per primitive
+  std::vector<float> localBounds;
+  // the same in world space, updated with models
+  geom::fsphere_soa bounds;
+
+  size_t size() const { return params.size() / 4; }
+};
+
+// instances [first, first + count) of one primitive type
+struct InstanceRange {
+  Primitive type;
+  size_t first, count;
+};
+
+// scene.yaml converted once at load time; rendering only reads these arrays
+struct CompiledScene {
+  PrimitiveArrays primitives[PRIMITIVE_TYPES];
+  // groups and primitives; moving a group moves everything below it
+  SceneGraph graph;
+  // keyframe tracks; track i moves node animated[i]
+  Animation animation;
+  std::vector<SceneGraph::Node> animated;
+
+  size_t size() const;
+  // sets the local transforms of the animated nodes to the tracks at time (seconds)
+  void animate(float time);
+  // recomposes the graph and rewrites the models of the primitives below the nodes that moved,
+  // appending them to moved. Returns the number of graph nodes updated.
+  size_t update(std::vector<InstanceRange> &moved);
+  // appends the instances whose bounds intersect the frustum of the column-major matrix
+  // viewProjection to visible, in runs; runs at most gap instances apart are merged.
+  // Returns the number of visible instances.
+  size_t cull(const float *viewProjection, size_t gap, std::vector<InstanceRange> &visible);
+
+private:
+  // plane distances of the bounds of one type, see cull()
+  std::vector<float> distances;
+};
+
+// groups nest: - group: { position: [x, y, z], rotation: [roll, pitch, yaw], scale: s, children: [...] }
+// rotation and scale are optional. Groups and primitives may have
+//   animation: { loop: true, keys: [{ time: seconds, position: ..., rotation: ..., scale: ... }, ...] }
+// whose keys replace their own position.
+CompiledScene compileScene(const YAML::Node &sceneNode);
+
+// the instances whose model or params differ, adjacent ones merged.
+// false if the number of primitives of any type differs, then every instance moves.
+bool diffScenes(const CompiledScene &from, const CompiledScene &to, std::vector<InstanceRange> &changed);
+
+#endif // COMPILED_SCENE_H
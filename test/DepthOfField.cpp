@@ -0,0 +1,115 @@
+#include "DepthOfField.h"
+#include <algorithm>
+
+DepthOfField::DepthOfField()
+    : cocProgram(),
+      downsampleProgram(),
+      upsampleProgram(),
+      pool(NULL),
+      linear(NULL),
+      nearest(NULL),
+      cocTexture(NULL),
+      blurTexture(NULL),
+      cocFramebuffer(),
+      blurFramebuffer(),
+      requestedIterations(4),
+      numIterations(0),
+      halfWidth(0),
+      halfHeight(0) {}
+
+void DepthOfField::init(OpenGL11::RenderTargetPool &a_pool, OpenGL11::SamplerCache &samplers,
+                        OpenGL11::ShaderCompiler &compiler) {
+  pool = &a_pool;
+  linear = &samplers.get(OpenGL11::SamplerState(GL_LINEAR));
+  nearest = &samplers.get(OpenGL11::SamplerState(GL_NEAREST));
+  compiler.submit(cocProgram, "test/shaders/postprocess.vert", "test/shaders/dof_coc.frag");
+  compiler.submit(downsampleProgram, "test/shaders/postprocess.vert", "test/shaders/kawase_down.frag");
+  compiler.submit(upsampleProgram, "test/shaders/postprocess.vert", "test/shaders/kawase_up.frag");
+  GL_CHECK_ERROR();
+}
+
+bool DepthOfField::isReady() {
+  return cocProgram.isReady() && downsampleProgram.isReady() && upsampleProgram.isReady();
+}
+
+void DepthOfField::setIterations(int n) {
+  requestedIterations = std::max(0, n);
+  if (halfWidth > 0 && halfHeight > 0) {
+    resize(2 * halfWidth, 2 * halfHeight);
+  }
+}
+
+void DepthOfField::resize(int width, int height) {
+  halfWidth = std::max(1, width / 2), halfHeight = std::max(1, height / 2);
+  if (cocTexture) {
+    pool->release(*cocTexture);
+    pool->release(*blurTexture);
+  }
+  cocTexture = &pool->acquire(GL_RGBA16F, halfWidth, halfHeight);
+  blurTexture = &pool->acquire(GL_RGBA16F, halfWidth, halfHeight);
+  cocFramebuffer.attach(GL_COLOR_ATTACHMENT0, *cocTexture);
+  blurFramebuffer.attach(GL_COLOR_ATTACHMENT0, *blurTexture);
+
+  levelWidth.assign(1, halfWidth);
+  levelHeight.assign(1, halfHeight);
+  numIterations = 0;
+  while (numIterations < requestedIterations && levelWidth.back() >= 2 && levelHeight.back() >= 2) {
+    levelWidth.push_back(levelWidth.back() / 2);
+    levelHeight.push_back(levelHeight.back() / 2);
+    numIterations++;
+  }
+  while ((int) levelFramebuffers.size() < numIterations) {
+    levelFramebuffers.emplace_back();
+  }
+  levels.resize(numIterations);
+}
+
+void DepthOfField::pass(OpenGL11::ShaderProgram &program, OpenGL11::Framebuffer &target, int width, int height,
+                        OpenGL11::Texture2D &source, OpenGL11::VertexArray &vao, OpenGL11::Buffer<GLfloat> &quadBuffer) {
+  target.bind();
+  glViewport(0, 0, width, height);
+  program.bind(vao,
+      "pos",       quadBuffer,
+      "tex_color", source, *linear,
+      "width",     width,
+      "height",    height);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  GL_CHECK_ERROR();
+}
+
+void DepthOfField::render(OpenGL11::VertexArray &vao, OpenGL11::Buffer<GLfloat> &quadBuffer,
+                          OpenGL11::Texture2D &colorTexture, OpenGL11::Texture2D &depthTexture) {
+  if (halfWidth <= 0 || halfHeight <= 0) { return; }
+  // circle of confusion, computed once per half resolution pixel
+  cocFramebuffer.bind();
+  glViewport(0, 0, halfWidth, halfHeight);
+  cocProgram.bind(vao,
+      "pos",       quadBuffer,
+      "tex_color", colorTexture, *linear,
+      "tex_depth", depthTexture, *nearest,
+      "width",     halfWidth,
+      "height",    halfHeight);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  GL_CHECK_ERROR();
+
+  // the pyramid is transient: attached every frame, since the name of a texture the pool deleted
+  // can come back for a new one while the framebuffer still holds the old texture
+  for (int i = 0; i < numIterations; i++) {
+    levels[i] = &pool->acquire(GL_RGBA16F, levelWidth[i + 1], levelHeight[i + 1]);
+    levelFramebuffers[i].attach(GL_COLOR_ATTACHMENT0, *levels[i]);
+  }
+
+  OpenGL11::Texture2D *source = cocTexture;
+  for (int i = 0; i < numIterations; i++) {
+    pass(downsampleProgram, levelFramebuffers[i], levelWidth[i + 1], levelHeight[i + 1], *source, vao, quadBuffer);
+    source = levels[i];
+  }
+  // the level written by the upsampling pass has already been read by the downsampling chain
+  for (int i = numIterations - 2; i >= 0; i--) {
+    pass(upsampleProgram, levelFramebuffers[i], levelWidth[i + 1], levelHeight[i + 1], *levels[i + 1], vao, quadBuffer);
+  }
+  pass(upsampleProgram, blurFramebuffer, halfWidth, halfHeight, numIterations ? *levels[0] : *cocTexture, vao, quadBuffer);
+  for (int i = 0; i < numIterations; i++) {
+    pool->release(*levels[i]);
+  }
+}
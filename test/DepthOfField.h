@@ -0,0 +1,52 @@
+#ifndef DEPTH_OF_FIELD_H
+#define DEPTH_OF_FIELD_H
+#include <vector>
+#include "OpenGL++11.h"
+
+/*
+ * depth of field with a dual Kawase pyramid:
+ *
+ *   coc       full resolution color & depth -> half resolution color (rgb) + circle of confusion (a)
+ *   down x n  each level is half the size of the previous one
+ *   up x n    back to half resolution
+ *
+ * every pass reads one texture and writes another, so no texture is sampled while attached.
+ * the final pass blends the sharp color and blurred() by the circle of confusion in coc().
+ * all targets come from a RenderTargetPool; the pyramid levels are only held during render().
+ */
+class DepthOfField {
+public:
+  DepthOfField();
+
+  // the programs are submitted to the compiler; render() only after isReady()
+  void init(OpenGL11::RenderTargetPool &pool, OpenGL11::SamplerCache &samplers,
+            OpenGL11::ShaderCompiler &compiler);
+  bool isReady();
+  void resize(int width, int height);
+  void render(OpenGL11::VertexArray &vao, OpenGL11::Buffer<GLfloat> &quadBuffer,
+              OpenGL11::Texture2D &colorTexture, OpenGL11::Texture2D &depthTexture);
+
+  // number of downsampling (= upsampling) passes, limited by the size of the half resolution target
+  void setIterations(int n);
+  int iterations() const { return numIterations; }
+
+  OpenGL11::Texture2D& coc() { return *cocTexture; }
+  OpenGL11::Texture2D& blurred() { return *blurTexture; }
+
+private:
+  OpenGL11::ShaderProgram cocProgram, downsampleProgram, upsampleProgram;
+  OpenGL11::RenderTargetPool *pool;
+  OpenGL11::Sampler *linear, *nearest;
+  OpenGL11::Texture2D *cocTexture, *blurTexture;
+  OpenGL11::Framebuffer cocFramebuffer, blurFramebuffer;
+  // pyramid levels 1 .. n (level 0 is cocTexture) and their framebuffers
+  std::vector<OpenGL11::Texture2D*> levels;
+  std::vector<OpenGL11::Framebuffer> levelFramebuffers;
+  std::vector<int> levelWidth, levelHeight;
+  int requestedIterations, numIterations, halfWidth, halfHeight;
+
+  void pass(OpenGL11::ShaderProgram &program, OpenGL11::Framebuffer &target, int width, int height,
+            OpenGL11::Texture2D &source, OpenGL11::VertexArray &vao, OpenGL11::Buffer<GLfloat> &quadBuffer);
+};
+
+#endif // DEPTH_OF_FIELD_H
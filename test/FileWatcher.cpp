@@ -0,0 +1,61 @@
+#include "FileWatcher.h"
+#include <algorithm>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+FileWatcher::FileWatcher() : fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {}
+
+FileWatcher::~FileWatcher() {
+  if (fd >= 0) {
+    close(fd);
+  }
+}
+
+bool FileWatcher::watch(const std::string &directory) {
+  if (fd < 0) {
+    return false;
+  }
+  int wd = inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0) {
+    return false;
+  }
+  directories[wd] = directory;
+  return true;
+}
+
+std::vector<std::string> FileWatcher::changes() {
+  std::vector<std::string> changed;
+  if (fd < 0) {
+    return changed;
+  }
+  alignas(struct inotify_event) char buffer[4096];
+  for (;;) {
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      // EAGAIN: no more events
+      break;
+    }
+    for (char *p = buffer; p < buffer + length;) {
+      struct inotify_event *event = (struct inotify_event *) p;
+      p += sizeof(struct inotify_event) + event->len;
+      std::map<int, std::string>::const_iterator dir = directories.find(event->wd);
+      if (dir == directories.end() || !event->len) {
+        continue;
+      }
+      std::string path = dir->second + "/" + event->name;
+      if (std::find(changed.begin(), changed.end(), path) == changed.end()) {
+        changed.push_back(path);
+      }
+    }
+  }
+  return changed;
+}
+#else
+FileWatcher::FileWatcher() : fd(-1) {}
+FileWatcher::~FileWatcher() {}
+bool FileWatcher::watch(const std::string &) { return false; }
+std::vector<std::string> FileWatcher::changes() { return std::vector<std::string>(); }
+#endif
@@ -0,0 +1,32 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * files written or replaced in a set of directories, through inotify.
+ *
+ * changes() never blocks, so it can be called once per frame. Paths are reported as
+ * "directory/name" with the directory spelled as given to watch(). Editors that save through
+ * a temporary file and rename() are covered by IN_MOVED_TO. On other systems nothing is reported.
+ */
+class FileWatcher {
+public:
+  FileWatcher();
+  ~FileWatcher();
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+
+  // false if the directory cannot be watched
+  bool watch(const std::string &directory);
+  // each changed path once, in the order of the first event
+  std::vector<std::string> changes();
+
+private:
+  int fd;
+  std::map<int, std::string> directories;
+};
+
+#endif // FILE_WATCHER_H
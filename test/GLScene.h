@@ -1,23 +1,49 @@
 #ifndef ABSTRACTSCENE_H
 #define ABSTRACTSCENE_H
 
+#include <chrono>
+#include <cstdint>
+
 class QOpenGLContext;
 
 class GLScene {
 public:
-    GLScene() : context(0) {}
+    GLScene() : context(0), framebufferId(0), simulated(false), simulatedTime(0) {}
     virtual ~GLScene(){}
 
     void setContext(QOpenGLContext *a_context) { context = a_context; }
     QOpenGLContext* getContext() const { return context; }
 
+    // framebuffer object the final image is rendered into (0: the window)
+    void setDefaultFramebuffer(unsigned int id) { framebufferId = id; }
+    unsigned int defaultFramebuffer() const { return framebufferId; }
+
+    // drive the scene with a simulated clock (milliseconds) instead of the wall clock
+    void setTime(int64_t msecs) { simulated = true; simulatedTime = msecs; }
+
     virtual void init() = 0;
     virtual void update() = 0;
     virtual void render() = 0;
     virtual void resize(int width, int height) = 0;
+    // block until everything loaded in the background (shaders) is ready
+    virtual void waitUntilReady() {}
 
 protected:
     QOpenGLContext *context;
+
+    // milliseconds, from the simulated clock when set
+    int64_t currentTime() const {
+        if (simulated) {
+            return simulatedTime;
+        }
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    unsigned int framebufferId;
+    bool simulated;
+    int64_t simulatedTime;
 };
 
 #endif // ABSTRACTSCENE_H
@@ -0,0 +1,89 @@
+#include "HeadlessContext.h"
+#include <EGL/eglext.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static bool hasExtension(const char *extensions, const char *name) {
+  if (!extensions) {
+    return false;
+  }
+  size_t length = strlen(name);
+  for (const char *p = strstr(extensions, name); p; p = strstr(p + length, name)) {
+    if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void checkEGL(bool ok, const char *what) {
+  if (!ok) {
+    throw std::runtime_error(std::string(what) + " failed (EGL error " + std::to_string(eglGetError()) + ")");
+  }
+}
+
+HeadlessContext::HeadlessContext() : display(EGL_NO_DISPLAY), context(EGL_NO_CONTEXT), surface(EGL_NO_SURFACE) {
+  const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+  if (hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay) {
+      display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+  }
+  if (display == EGL_NO_DISPLAY) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+  checkEGL(display != EGL_NO_DISPLAY, "eglGetDisplay");
+  EGLint major, minor;
+  checkEGL(eglInitialize(display, &major, &minor), "eglInitialize");
+  checkEGL(eglBindAPI(EGL_OPENGL_API), "eglBindAPI");
+
+  EGLint configAttributes[] = {
+    EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config = 0;
+  EGLint numConfigs = 0;
+  eglChooseConfig(display, configAttributes, &config, 1, &numConfigs);
+
+  EGLint contextAttributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION,       3,
+    EGL_CONTEXT_MINOR_VERSION,       3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  const char *displayExtensions = eglQueryString(display, EGL_EXTENSIONS);
+  bool surfaceless = hasExtension(displayExtensions, "EGL_KHR_surfaceless_context");
+  if (surfaceless && hasExtension(displayExtensions, "EGL_KHR_no_config_context")) {
+    context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+  } else {
+    checkEGL(numConfigs > 0, "eglChooseConfig");
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+  }
+  checkEGL(context != EGL_NO_CONTEXT, "eglCreateContext");
+  if (!surfaceless) {
+    EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+    checkEGL(surface != EGL_NO_SURFACE, "eglCreatePbufferSurface");
+  }
+}
+
+HeadlessContext::~HeadlessContext() {
+  doneCurrent();
+  if (surface != EGL_NO_SURFACE) {
+    eglDestroySurface(display, surface);
+  }
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+}
+
+void HeadlessContext::makeCurrent() {
+  checkEGL(eglMakeCurrent(display, surface, surface, context), "eglMakeCurrent");
+}
+
+void HeadlessContext::doneCurrent() {
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+}
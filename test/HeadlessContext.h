@@ -0,0 +1,29 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#include <EGL/egl.h>
+
+/*
+ * OpenGL 3.3 core context without a window or a display server.
+ *
+ * EGL on the surfaceless platform (EGL_MESA_platform_surfaceless) is used when available, and the
+ * default display otherwise. The context is made current without a surface (EGL_KHR_surfaceless_context)
+ * or with a 1x1 pbuffer, so everything has to be rendered into framebuffer objects.
+ */
+class HeadlessContext {
+public:
+  HeadlessContext();
+  ~HeadlessContext();
+  HeadlessContext(const HeadlessContext&) = delete;
+  HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+  void makeCurrent();
+  void doneCurrent();
+
+private:
+  EGLDisplay display;
+  EGLContext context;
+  EGLSurface surface;
+};
+
+#endif // HEADLESS_CONTEXT_H
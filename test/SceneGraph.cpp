@@ -0,0 +1,49 @@
+#include "SceneGraph.h"
+#include <algorithm>
+#include <stdexcept>
+
+const SceneGraph::Node SceneGraph::NONE;
+
+SceneGraph::Node SceneGraph::add(Node parent, const geom::ftransform &local) {
+  if (parent != NONE && parent >= size()) {
+    throw std::logic_error("SceneGraph::add: no such parent");
+  }
+  Node node = parent == NONE ? size() : end(parent);
+  for (Node i = node; i < size(); i++) {
+    if (_parent[i] != NONE && _parent[i] >= node) {
+      _parent[i]++;
+    }
+  }
+  for (Node i = parent; i != NONE; i = _parent[i]) {
+    _size[i]++;
+  }
+  _local.insert(_local.begin() + node, local);
+  _world.insert(_world.begin() + node, local);
+  _parent.insert(_parent.begin() + node, parent);
+  _size.insert(_size.begin() + node, 1);
+  _dirty.insert(_dirty.begin() + node, 1);
+  return node;
+}
+
+void SceneGraph::setLocal(Node node, const geom::ftransform &local) {
+  _local[node] = local;
+  _dirty[node] = 1;
+}
+
+size_t SceneGraph::update() {
+  _updated.clear();
+  _updatedCount = 0;
+  std::vector<uint8_t>::iterator dirty = _dirty.begin();
+  while ((dirty = std::find(dirty, _dirty.end(), 1)) != _dirty.end()) {
+    Node first = dirty - _dirty.begin(), last = end(first);
+    // parents precede their children, so every parent is final when its child is composed
+    for (Node i = first; i < last; i++) {
+      _world[i] = _parent[i] == NONE ? _local[i] : _world[_parent[i]] * _local[i];
+    }
+    std::fill(_dirty.begin() + first, _dirty.begin() + last, 0);
+    _updated.push_back(Range { first, last });
+    _updatedCount += last - first;
+    dirty = _dirty.begin() + last;
+  }
+  return _updatedCount;
+}
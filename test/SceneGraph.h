@@ -0,0 +1,52 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "geom.h"
+
+/*
+ * transform hierarchy stored as flat arrays in depth-first order: parents come before their
+ * children and the subtree of node i is [i, end(i)). world(i) = world(parent(i)) * local(i).
+ *
+ * setLocal() only marks the node dirty. update() walks the dirty flags once and recomposes
+ * the subtrees below dirty nodes, which are contiguous; clean subtrees are not touched.
+ */
+class SceneGraph {
+public:
+  typedef size_t Node;
+  // parent of the roots
+  static const Node NONE = (Node) -1;
+  // nodes [first, last) recomposed by the last update()
+  struct Range {
+    Node first, last;
+  };
+
+  // new last child of parent (NONE: a new root). Nodes from the returned index on move up by one,
+  // so appending in depth-first order keeps every index stable.
+  Node add(Node parent, const geom::ftransform &local);
+  void setLocal(Node node, const geom::ftransform &local);
+
+  size_t size() const { return _local.size(); }
+  Node parent(Node node) const { return _parent[node]; }
+  Node end(Node node) const { return node + _size[node]; }
+  const geom::ftransform &local(Node node) const { return _local[node]; }
+  // as of the last update()
+  const geom::ftransform &world(Node node) const { return _world[node]; }
+
+  // recomposes the world transforms below dirty nodes, returns the number of nodes updated
+  size_t update();
+  const std::vector<Range> &updated() const { return _updated; }
+  size_t updatedCount() const { return _updatedCount; }
+
+private:
+  std::vector<geom::ftransform> _local, _world;
+  std::vector<Node> _parent;
+  // nodes in the subtree, including the node itself
+  std::vector<size_t> _size;
+  std::vector<uint8_t> _dirty;
+  std::vector<Range> _updated;
+  size_t _updatedCount = 0;
+};
+
+#endif // SCENE_GRAPH_H
@@ -3,163 +3,186 @@
 #include <GLXW/glxw.h>
 #include <GL/gl.h>
 #include <array>
+#include <algorithm>
 #include <iostream>
-#include <QDateTime>
 #include <yaml-cpp/yaml.h>
 #include "geom.h"
 
 SimpleGLScene::SimpleGLScene()
-    : shader(),
-      postprocess(),
-      blur(),
+    : postprocess(),
+      fallback(),
       vao(),
-      renderedColorTexture(GL_RGBA8),
-      renderedDepthTexture(GL_DEPTH_COMPONENT24),
+      targets(),
+      samplers(),
+      programs(),
+      compiler(programs),
+      renderedColorTexture(NULL),
+      renderedDepthTexture(NULL),
       framebuffer(),
       stripBuffer(GL_ARRAY_BUFFER),
       quadBuffer(GL_ARRAY_BUFFER),
-      camera() {}
+      cameraBuffer(),
+      instanceModelBuffer(GL_ARRAY_BUFFER),
+      instanceParamBuffer(GL_ARRAY_BUFFER),
+      camera(),
+      dof() {}
 
 void SimpleGLScene::init() {
-  t0 = QDateTime::currentMSecsSinceEpoch();
+  t0 = currentTime();
   glxwInit();
   glGetError(); // read & ignore GL_INVALID_ENUM here (GLEW bug)
+  // report errors through KHR_debug instead of glGetError() when available
+  OpenGL11::enableDebugOutput();
   initShaders();
   initBuffers();
-  glEnable(GL_DEPTH_TEST);
-  sceneNode = YAML::LoadFile("test/scene.yaml");
+  OpenGL11::StateCache::current().enable(GL_DEPTH_TEST);
+  scene = compileScene(YAML::LoadFile("test/scene.yaml"));
+  initInstances();
+  watcher.watch("test");
+  watcher.watch("test/shaders");
 }
 
 void SimpleGLScene::update() {
   // miliseconds from init()
-  float uptime = QDateTime::currentMSecsSinceEpoch() - t0;
+  float uptime = currentTime() - t0;
   float alpha  = 0.6 - 0.5 * sin(M_PI * 0.00005 * uptime), beta = 0.0002 * uptime, r = 30.0 - 20.0 * sin(M_PI * 0.00005 * uptime);
   camera = geom::translate(0.0f, 0.0f, -r) * geom::rotate(0.0f, alpha, beta);
+  scene.animate(0.001f * uptime);
+  // only the subtrees below moved nodes are recomposed
+  updatedNodes = scene.update(movedInstances);
 }
 
 void SimpleGLScene::render() {
+  // update() keeps appending moved instances, upload them even while there is nothing to draw
+  uploadInstances(scene, movedInstances);
+  movedInstances.clear();
   // make sure SimpleGLScene::resize() is called (and the textures are ready).
-  if (!(sceneWidth * sceneHeight)) { return; }
-  OpenGL11::fmat4 model;
+  if (windowWidth <= 0 || windowHeight <= 0) { return; }
+  // while the window is being resized, keep rendering at the old size and stretch the result
+  if ((sceneWidth != windowWidth || sceneHeight != windowHeight) &&
+      (sceneWidth <= 0 || sceneHeight <= 0 || currentTime() - resizeTime >= RESIZE_SETTLE_MSECS)) {
+    resizeTargets();
+  }
+  reload();
+  // never waits with KHR_parallel_shader_compile
+  if (!compiler.poll() && reloadedPrograms) {
+    std::cout << "reloaded " << reloadedPrograms << " programs in "
+              << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reloadStart).count()
+              << " ms" << std::endl;
+    reloadedPrograms = 0;
+  }
   framebuffer.bind();
-  glEnable(GL_DEPTH_TEST);
+  glViewport(0, 0, sceneWidth, sceneHeight);
+  OpenGL11::StateCache::current().enable(GL_DEPTH_TEST);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   GL_CHECK_ERROR();
-  view = camera;
-  for (size_t i = 0; i < sceneNode.size(); i++) {
-    YAML::Node node_type = sceneNode[i];
-    YAML::Node node;
-    if (node_type["helix"]) {
-      node = node_type["helix"];
-      std::vector<float> p = (node["position"].as<std::vector<float>>());
-      model = geom::translate(p);
-      shader.bind(vao,
-          "pos",         stripBuffer,
-          "program",     1,
-          "r",           node["r"].as<GLfloat>(),
-          "width",       node["width"].as<GLfloat>(),
-          "num_v",       512.0f,
-          "angle",       node["angle"].as<GLfloat>(),
-          "helix_angle", node["helix_angle"].as<GLfloat>(),
-          "proj",        projection,
-          "view",        view,
-          "model",       model);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 512);
-      GL_CHECK_ERROR();
-    } else if (node_type["line"]) {
-      node = node_type["line"];
-      std::vector<GLfloat> p = (node["position"].as<std::vector<GLfloat>>());
-      shader.bind(vao,
-          "pos",         stripBuffer,
-          "program",     0,
-          "width",       node["width"].as<GLfloat>(),
-          "len",         node["len"].as<GLfloat>(),
-          "num_v",       512.0f,
-          "proj",        projection,
-          "view",        view,
-          "model",       model);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 512);
-      GL_CHECK_ERROR();
-    } else if (node_type["clothoid"]) {
-      node = node_type["clothoid"];
-      std::vector<GLfloat> p = (node["position"].as<std::vector<GLfloat>>());
-      shader.bind(vao,
-          "pos",         stripBuffer,
-          "program",     2,
-          "width",       node["width"].as<GLfloat>(),
-          "angle",       node["angle"].as<GLfloat>(),
-          "slope_angle", node["slope_angle"].as<GLfloat>(),
-          "len",         node["len"].as<GLfloat>(),
-          "num_v",       512.0f,
-          "proj",        projection,
-          "view",        view,
-          "model",       model);
-      glDrawArrays(GL_TRIANGLE_STRIP, 0, 512);
-      GL_CHECK_ERROR();
+  OpenGL11::fmat4 view;
+  geom::to_matrix(camera, view.memptr());
+  CameraBlock cameraBlock;
+  std::copy(projection.memptr(), projection.memptr() + 16, cameraBlock.proj);
+  std::copy(view.memptr(), view.memptr() + 16, cameraBlock.view);
+  cameraBuffer.update(cameraBlock);
+  cameraBuffer.bindBase(CAMERA_BINDING);
+
+  // only primitives whose bounds intersect the frustum are submitted
+  OpenGL11::fmat4 viewProjection = projection * view;
+  visibleRanges.clear();
+  visibleCount = scene.cull(viewProjection.memptr(), CULL_MERGE_GAP, visibleRanges);
+
+  // one instanced draw per run of visible instances, each primitive type with its own program
+  for (const InstanceRange &range : visibleRanges) {
+    OpenGL11::ShaderProgram &shader = *primitiveShaders[range.type];
+    if (!shader.isReady()) {
+      continue;
+    }
+    if (cameraBlockProgram[range.type] != shader.id()) {
+      shader.setUniformBlockBinding("Camera", CAMERA_BINDING);
+      cameraBlockProgram[range.type] = shader.id();
     }
+    intptr_t first = batches[range.type].first + range.first;
+    intptr_t modelOffset = first * 16 * sizeof(GLfloat), paramOffset = first * 4 * sizeof(GLfloat);
+    shader.bind(vao,
+        "pos",     stripBuffer,
+        "model",   instanceModelBuffer, modelOffset,
+        "params",  instanceParamBuffer, paramOffset,
+        "num_v",   512.0f);
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 512, range.count);
+    GL_CHECK_ERROR();
   }
   GL_CHECK_ERROR();
-  //framebuffer.detach(GL_DEPTH_ATTACHMENT);
-  glDisable(GL_DEPTH_TEST);
-  blur.bind(vao,
-      "pos",     quadBuffer,
-      "tex_color", renderedColorTexture,
-      "tex_depth", renderedDepthTexture,
-      "width",   sceneWidth,
-      "height",  sceneHeight,
-      "iter",    0);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  blur.bind(vao, "iter", 1);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  blur.bind(vao, "iter", 2);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  blur.bind(vao, "iter", 3);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  /*
-  blur.bind(vao, "iter", 4);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  blur.bind(vao, "iter", 5);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  */
-  framebuffer.unbind();
+  OpenGL11::StateCache::current().disable(GL_DEPTH_TEST);
+  bool depthOfField = dof.isReady() && postprocess.isReady();
+  if (depthOfField) {
+    dof.render(vao, quadBuffer, *renderedColorTexture, *renderedDepthTexture);
+  }
+  OpenGL11::StateCache::current().bindFramebuffer(GL_FRAMEBUFFER, defaultFramebuffer());
+  glViewport(0, 0, windowWidth, windowHeight);
 
   glClear(GL_COLOR_BUFFER_BIT);
-  postprocess.bind(vao,
-      "pos",     quadBuffer,
-      "tex_color", renderedColorTexture,
-      "width",   sceneWidth,
-      "height",  sceneHeight);
+  OpenGL11::Sampler &linear = samplers.get(OpenGL11::SamplerState(GL_LINEAR));
+  if (depthOfField) {
+    postprocess.bind(vao,
+        "pos",     quadBuffer,
+        "tex_color", *renderedColorTexture, linear,
+        "tex_blur",  dof.blurred(), linear,
+        "tex_coc",   dof.coc(), linear,
+        "width",   windowWidth,
+        "height",  windowHeight);
+  } else {
+    fallback.bind(vao,
+        "pos",     quadBuffer,
+        "tex_color", *renderedColorTexture, linear,
+        "width",   windowWidth,
+        "height",  windowHeight);
+  }
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
   GL_CHECK_ERROR();
+  targets.endFrame();
+  // delete the GL objects released during the frame in one call per type
+  OpenGL11::StateCache::current().flush();
+}
+
+void SimpleGLScene::waitUntilReady() {
+  compiler.finish();
 }
 
 void SimpleGLScene::resize(int width, int height) {
- sceneWidth = width, sceneHeight = height;
- glViewport(0, 0, width, height);
- projection = mat_perspective(60, width / (double) height, 1.0, 200.0);
- renderedColorTexture.allocate(width, height);
- renderedColorTexture.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
- renderedColorTexture.setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
- renderedColorTexture.setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
- renderedColorTexture.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
- renderedDepthTexture.allocate(width, height);
- renderedDepthTexture.setParameter(GL_TEXTURE_MIN_FILTER, GL_LINEAR);
- renderedDepthTexture.setParameter(GL_TEXTURE_MAG_FILTER, GL_LINEAR);
- renderedDepthTexture.setParameter(GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
- renderedDepthTexture.setParameter(GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
- framebuffer.attach(
-     GL_COLOR_ATTACHMENT0, renderedColorTexture,
-     GL_DEPTH_ATTACHMENT,  renderedDepthTexture);
- GL_CHECK_ERROR();
+  // the targets are reallocated by render() once the size settles
+  windowWidth = width, windowHeight = height;
+  resizeTime = currentTime();
 }
 
-void SimpleGLScene::initShaders() {
-  shader.link("test/shaders/helix.vert", "test/shaders/helix.frag");
+void SimpleGLScene::resizeTargets() {
+  if (renderedColorTexture) {
+    targets.release(*renderedColorTexture);
+    targets.release(*renderedDepthTexture);
+  }
+  sceneWidth = windowWidth, sceneHeight = windowHeight;
+  projection = mat_perspective(60, sceneWidth / (double) sceneHeight, 1.0, 200.0);
+  renderedColorTexture = &targets.acquire(GL_RGBA8, sceneWidth, sceneHeight);
+  renderedDepthTexture = &targets.acquire(GL_DEPTH_COMPONENT24, sceneWidth, sceneHeight);
+  framebuffer.attach(
+      GL_COLOR_ATTACHMENT0, *renderedColorTexture,
+      GL_DEPTH_ATTACHMENT,  *renderedDepthTexture);
+  dof.resize(sceneWidth, sceneHeight);
   GL_CHECK_ERROR();
-  blur.link("test/shaders/postprocess.vert", "test/shaders/kawase.frag");
+}
+
+void SimpleGLScene::initShaders() {
+  fallback.link(programs, OpenGL11::ProgramSource("test/shaders/postprocess.vert", "test/shaders/gamma.frag")
+                            .define("NO_DEPTH_OF_FIELD"));
   GL_CHECK_ERROR();
-  postprocess.link("test/shaders/postprocess.vert", "test/shaders/gamma.frag");
+  // everything is submitted before any status is queried, so the driver can compile in parallel
+  primitivePrograms.reset(new OpenGL11::ProgramPermutations(compiler, "test/shaders/helix.vert", "test/shaders/helix.frag"));
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    primitiveShaders[type] = &primitivePrograms->get({{"PRIMITIVE", std::to_string(type)}});
+  }
+  dof.init(targets, samplers, compiler);
+  compiler.submit(postprocess, "test/shaders/postprocess.vert", "test/shaders/gamma.frag");
   GL_CHECK_ERROR();
+  OpenGL11::ProgramBinaryCache::Statistics stats = programs.statistics();
+  std::cout << "program binary cache: " << stats.hits << " hits, " << stats.misses << " misses ("
+            << stats.rejected << " rejected)" << std::endl;
   framebuffer.create();
   GL_CHECK_ERROR();
 }
@@ -187,3 +210,77 @@ void SimpleGLScene::initBuffers() {
   vao.create();
   GL_CHECK_ERROR();
 }
+
+// copy the compiled primitives into the per-instance attribute buffers, one batch per type
+void SimpleGLScene::initInstances() {
+  instanceModelBuffer.setDivisor(1);
+  instanceModelBuffer.allocate(NULL, 16, 16 * sizeof(GLfloat) * scene.size());
+  instanceParamBuffer.setDivisor(1);
+  instanceParamBuffer.allocate(NULL, 4, 4 * sizeof(GLfloat) * scene.size());
+  GLsizei first = 0;
+  for (int type = 0; type < PRIMITIVE_TYPES; type++) {
+    const PrimitiveArrays &arrays = scene.primitives[type];
+    batches[type].first = first;
+    batches[type].count = arrays.size();
+    instanceModelBuffer.update(16 * first, arrays.models);
+    instanceParamBuffer.update(4 * first, arrays.params);
+    first += arrays.size();
+  }
+}
+
+// rewrite the model matrices and shape parameters of the given instances
+void SimpleGLScene::uploadInstances(const CompiledScene &from, const std::vector<InstanceRange> &ranges) {
+  for (size_t i = 0; i < ranges.size(); i++) {
+    const PrimitiveArrays &arrays = from.primitives[ranges[i].type];
+    size_t first = ranges[i].first, count = ranges[i].count, offset = batches[ranges[i].type].first + first;
+    instanceModelBuffer.update(16 * offset, OpenGL11::Span<const GLfloat>(&arrays.models[16 * first], 16 * count));
+    instanceParamBuffer.update(4 * offset, OpenGL11::Span<const GLfloat>(&arrays.params[4 * first], 4 * count));
+  }
+}
+
+// shaders are recompiled in the background, the scene is diffed against the running one
+void SimpleGLScene::reload() {
+  std::vector<std::string> changed = watcher.changes();
+  if (changed.empty()) {
+    return;
+  }
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if (std::find(changed.begin(), changed.end(), "test/scene.yaml") != changed.end()) {
+    reloadScene();
+  }
+  size_t programs = compiler.reload(changed);
+  if (programs) {
+    if (!reloadedPrograms) {
+      reloadStart = start;
+    }
+    reloadedPrograms += programs;
+  }
+}
+
+void SimpleGLScene::reloadScene() {
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  CompiledScene next;
+  try {
+    next = compileScene(YAML::LoadFile("test/scene.yaml"));
+  } catch (std::exception &e) {
+    std::cout << "scene reload failed: " << e.what() << std::endl;
+    return;
+  }
+  std::vector<InstanceRange> changed;
+  size_t updated = 0;
+  if (diffScenes(scene, next, changed)) {
+    uploadInstances(next, changed);
+    for (size_t i = 0; i < changed.size(); i++) {
+      updated += changed[i].count;
+    }
+    scene = std::move(next);
+  } else {
+    // the batches move, upload everything
+    scene = std::move(next);
+    initInstances();
+    updated = scene.size();
+  }
+  std::cout << "scene reloaded: " << updated << " of " << scene.size() << " instances updated in "
+            << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+            << " ms" << std::endl;
+}
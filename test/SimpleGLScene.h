@@ -4,7 +4,15 @@
 #include "GLScene.h"
 #include "OpenGL++11.h"
 #include "geom.h"
-#include <yaml-cpp/yaml.h>
+#include "CompiledScene.h"
+#include "DepthOfField.h"
+#include "FileWatcher.h"
+#include <chrono>
+
+// std140 layout of the Camera block in helix.vert
+struct CameraBlock {
+  GLfloat proj[16], view[16];
+};
 
 class SimpleGLScene : public GLScene {
 public:
@@ -14,21 +22,68 @@ public:
   virtual void update();
   virtual void render();
   virtual void resize(int width, int height);
+  virtual void waitUntilReady();
+  // scene graph nodes recomposed by the last update()
+  size_t updatedSceneNodes() const { return updatedNodes; }
+  // primitives inside and outside the view frustum in the last render()
+  size_t visibleInstances() const { return visibleCount; }
+  size_t culledInstances() const { return scene.size() - visibleCount; }
 
 private:
-  OpenGL11::ShaderProgram shader, postprocess, blur;
+  enum { CAMERA_BINDING = 0 };
+  // render targets follow the window size once it has not changed for this long
+  enum { RESIZE_SETTLE_MSECS = 100 };
+  // culled instances between two visible runs that are drawn anyway to save a draw call
+  enum { CULL_MERGE_GAP = 16 };
+  // instances [first, first + count) of the instance buffers
+  struct Batch {
+    GLsizei first, count;
+  };
+  // fallback: gamma correction only, linked synchronously; used until the others are compiled
+  OpenGL11::ShaderProgram postprocess, fallback;
   OpenGL11::VertexArray vao;
-  OpenGL11::Texture2D renderedColorTexture, renderedDepthTexture;
+  OpenGL11::RenderTargetPool targets;
+  OpenGL11::SamplerCache samplers;
+  OpenGL11::ProgramBinaryCache programs;
+  OpenGL11::ShaderCompiler compiler;
+  // helix.vert specialized by PRIMITIVE, one program per primitive type
+  std::unique_ptr<OpenGL11::ProgramPermutations> primitivePrograms;
+  OpenGL11::ShaderProgram *primitiveShaders[PRIMITIVE_TYPES];
+  // program the Camera block binding was set on, per primitive type (a reload replaces the program)
+  GLuint cameraBlockProgram[PRIMITIVE_TYPES] = {};
+  // test/scene.yaml and test/shaders/ are reloaded while the scene runs
+  FileWatcher watcher;
+  std::chrono::steady_clock::time_point reloadStart;
+  size_t reloadedPrograms = 0;
+  OpenGL11::Texture2D *renderedColorTexture, *renderedDepthTexture;
   OpenGL11::Framebuffer framebuffer;
   OpenGL11::Buffer<GLfloat> stripBuffer, quadBuffer;
+  OpenGL11::UniformBuffer<CameraBlock> cameraBuffer;
+  // per-instance model matrices and shape parameters, grouped by primitive type
+  OpenGL11::Buffer<GLfloat> instanceModelBuffer, instanceParamBuffer;
+  Batch batches[PRIMITIVE_TYPES];
   geom::ftransform camera;
-  OpenGL11::fmat4 view, projection;
-  uint64_t t0;
-  YAML::Node sceneNode;
+  OpenGL11::fmat4 projection;
+  int64_t t0;
+  CompiledScene scene;
+  // primitives below scene graph nodes that moved in update(), uploaded by render()
+  std::vector<InstanceRange> movedInstances;
+  size_t updatedNodes = 0;
+  // runs of instances to draw this frame, from CompiledScene::cull()
+  std::vector<InstanceRange> visibleRanges;
+  size_t visibleCount = 0;
+  DepthOfField dof;
 
   void initShaders();
   void initBuffers();
-  int sceneWidth = 0, sceneHeight = 0;
+  void initInstances();
+  void uploadInstances(const CompiledScene &from, const std::vector<InstanceRange> &ranges);
+  void reload();
+  void reloadScene();
+  void resizeTargets();
+  // size of the render targets and of the window
+  int sceneWidth = 0, sceneHeight = 0, windowWidth = 0, windowHeight = 0;
+  int64_t resizeTime = 0;
 };
 
 #endif // SIMPLE_GL_SCENE_H
@@ -29,6 +29,9 @@ SimpleGLWindow::SimpleGLWindow(GLScene *a_scene, QScreen *screen) : QWindow(scre
     format.setMinorVersion(3);
     format.setSamples(4);
     format.setProfile(QSurfaceFormat::CoreProfile);
+#ifndef QT_NO_DEBUG
+    format.setOption(QSurfaceFormat::DebugContext);
+#endif
 
     setFormat(format);
     create();
@@ -26,6 +26,7 @@
 #define GEOM_H
 #include <iostream>
 #include <array>
+#include <vector>
 #include <complex>
 #include <cmath>
 
@@ -240,30 +241,65 @@ namespace geom {
 #ifdef USE_ARMADILLO
       inline operator typename arma::Mat<T>::template fixed<4, 4> () {
         typename arma::Mat<T>::template fixed<4, 4> m;
-        m(0, 0) = scale * (1 - 2 * (rot.y * rot.y + rot.z * rot.z));
-        m(1, 0) = scale * (2 * (rot.x * rot.y - rot.z * rot.w));
-        m(2, 0) = scale * (2 * (rot.x * rot.z + rot.y * rot.w));
-        m(3, 0) = 0;
-
-        m(0, 1) = scale * (2 * (rot.y * rot.x + rot.z * rot.w));
-        m(1, 1) = scale * (1 - 2 * (rot.z * rot.z + rot.x * rot.x));
-        m(2, 1) = scale * (2 * (rot.y * rot.z - rot.x * rot.w));
-        m(3, 1) = 0;
-
-        m(0, 2) = scale * (2 * (rot.z * rot.x - rot.y * rot.w));
-        m(1, 2) = scale * (2 * (rot.z * rot.y + rot.x * rot.w));
-        m(2, 2) = scale * (1 - 2 * (rot.x * rot.x + rot.y * rot.y));
-        m(3, 2) = 0;
-
-        m(0, 3) = pos.x;
-        m(1, 3) = pos.y;
-        m(2, 3) = pos.z;
-        m(3, 3) = 1;
+        to_matrix(*this, m.memptr());
         return m;
       };
 #endif
   };
   
+  /* 4x4 column-major matrix of t into m[0, 16), no armadillo needed */
+  template <typename T>
+  inline void to_matrix(const transform<T>& t, T *m) {
+    const quaternion<T> &rot = t.rot;
+    T s = t.scale;
+    m[0]  = s * (1 - 2 * (rot.y * rot.y + rot.z * rot.z));
+    m[1]  = s * (2 * (rot.x * rot.y - rot.z * rot.w));
+    m[2]  = s * (2 * (rot.x * rot.z + rot.y * rot.w));
+    m[3]  = 0;
+    m[4]  = s * (2 * (rot.y * rot.x + rot.z * rot.w));
+    m[5]  = s * (1 - 2 * (rot.z * rot.z + rot.x * rot.x));
+    m[6]  = s * (2 * (rot.y * rot.z - rot.x * rot.w));
+    m[7]  = 0;
+    m[8]  = s * (2 * (rot.z * rot.x - rot.y * rot.w));
+    m[9]  = s * (2 * (rot.z * rot.y + rot.x * rot.w));
+    m[10] = s * (1 - 2 * (rot.x * rot.x + rot.y * rot.y));
+    m[11] = 0;
+    m[12] = t.pos.x;
+    m[13] = t.pos.y;
+    m[14] = t.pos.z;
+    m[15] = 1;
+  }
+
+  /* matrices of t[0, n) packed into out[0, 16 n), e.g. a mapped instance buffer */
+  template <typename T>
+  inline void to_matrices(const transform<T> *t, size_t n, T *out) {
+    for (size_t i = 0; i < n; i++) {
+      to_matrix(t[i], out + 16 * i);
+    }
+  }
+
+  /*
+   * planes (a, b, c, d) of the clip volume of the column-major matrix m (e.g. projection * view)
+   * into planes[0, 24): left, right, bottom, top, near, far. Inside is a x + b y + c z + d >= 0,
+   * (a, b, c) is of unit length so that this is the distance from the plane.
+   */
+  template <typename T>
+  inline void frustum_planes(const T *m, T *planes) {
+    for (int p = 0; p < 6; p++) {
+      // row 3 of m plus or minus row 0, 1 or 2
+      int row = p / 2;
+      T sign = (p % 2) ? -1 : 1;
+      T *plane = planes + 4 * p;
+      for (int column = 0; column < 4; column++) {
+        plane[column] = m[4 * column + 3] + sign * m[4 * column + row];
+      }
+      T length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+      for (int column = 0; column < 4; column++) {
+        plane[column] /= length;
+      }
+    }
+  }
+
   template <typename T>
   inline quaternion<T> operator *(const T& s, const transform<T>& t) {
     return t * s;
@@ -0,0 +1,459 @@
+/*
+ * structure of arrays containers for geom::quaternion and geom::transform with batch kernels
+ *
+ *   quaternion_soa<T>   w[], x[], y[], z[]
+ *   transform_soa<T>    position x[], y[], z[], rot (quaternion_soa), scale[]
+ *   sphere_soa<T>       center x[], y[], z[], radius r[]
+ *
+ *   mul(a, b, out)          out[i] = a[i] * b[i]
+ *   qrot(q, v, out)         out[i] = qrot(q[i], v[i])
+ *   normalize(q, out)       out[i] = normalize(q[i])
+ *   compose(t1, t2, out)    out[i] = t1[i] * t2[i]
+ *   nlerp(a, b, u, out)     out[i] = normalize((1 - u[i]) a[i] + u[i] b[i])
+ *   slerp(a, b, theta, u, out)
+ *                           out[i] = (sin((1 - u[i]) theta[i]) a[i] + sin(u[i] theta[i]) b[i]) / sin(theta[i]),
+ *                           theta[i] in (0, pi / 2] the angle between the unit quaternions a[i] and b[i]
+ *   to_matrices(t, out)     out[16 * i, 16 * i + 16) = column-major 4x4 matrix of t[i]
+ *   stream_matrices(t, out) to_matrices() with non-temporal stores, for write-only out
+ *   plane_distances(s, planes, count, out)
+ *                           out[i] = min over the planes p of p.a x + p.b y + p.c z + p.d + r of s[i]:
+ *                           negative where sphere i lies entirely outside a plane (frustum culling)
+ *
+ * the templates are the scalar reference. For float the work is split into SIMD lanes
+ * (AVX2+FMA or SSE2 on x86, NEON on AArch64), picked at run time by geom::simd::active();
+ * the results match the scalar code up to rounding. out may be one of the inputs.
+ */
+
+#ifndef GEOM_SOA_H
+#define GEOM_SOA_H
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include "geom.h"
+
+#if (defined(__x86_64__) || defined(_M_X64) || defined(__i386__)) && (defined(__SSE2__) || defined(_M_X64))
+#define GEOM_SIMD_SSE2
+#include <immintrin.h>
+#if defined(__GNUC__)
+// compiled with target attributes, used only if the CPU reports AVX2 and FMA
+#define GEOM_SIMD_AVX2
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define GEOM_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+namespace geom {
+  template <typename T>
+  class quaternion_soa {
+    public:
+      std::vector<T> w, x, y, z;
+      size_t size() const {
+        return w.size();
+      };
+      void resize(size_t n) {
+        w.resize(n), x.resize(n), y.resize(n), z.resize(n);
+      };
+      quaternion<T> get(size_t i) const {
+        return quaternion<T>(w[i], x[i], y[i], z[i]);
+      };
+      void set(size_t i, const quaternion<T> &q) {
+        w[i] = q.w, x[i] = q.x, y[i] = q.y, z[i] = q.z;
+      };
+      void push_back(const quaternion<T> &q) {
+        w.push_back(q.w), x.push_back(q.x), y.push_back(q.y), z.push_back(q.z);
+      };
+  };
+
+  template <typename T>
+  class transform_soa {
+    public:
+      // pos of transform<T>, whose w is always 0
+      std::vector<T> x, y, z;
+      quaternion_soa<T> rot;
+      std::vector<T> scale;
+      size_t size() const {
+        return scale.size();
+      };
+      void resize(size_t n) {
+        x.resize(n), y.resize(n), z.resize(n), rot.resize(n), scale.resize(n);
+      };
+      transform<T> get(size_t i) const {
+        return transform<T>(quaternion<T>(0, x[i], y[i], z[i]), rot.get(i), scale[i]);
+      };
+      void set(size_t i, const transform<T> &t) {
+        x[i] = t.pos.x, y[i] = t.pos.y, z[i] = t.pos.z, rot.set(i, t.rot), scale[i] = t.scale;
+      };
+      void push_back(const transform<T> &t) {
+        x.push_back(t.pos.x), y.push_back(t.pos.y), z.push_back(t.pos.z), rot.push_back(t.rot), scale.push_back(t.scale);
+      };
+  };
+
+  template <typename T>
+  class sphere_soa {
+    public:
+      std::vector<T> x, y, z, r;
+      size_t size() const {
+        return r.size();
+      };
+      void resize(size_t n) {
+        x.resize(n), y.resize(n), z.resize(n), r.resize(n);
+      };
+      void set(size_t i, const quaternion<T> &center, const T &radius) {
+        x[i] = center.x, y[i] = center.y, z[i] = center.z, r[i] = radius;
+      };
+  };
+
+  /* scalar path, from element begin on */
+  template <typename T>
+    inline void mul(const quaternion_soa<T> &a, const quaternion_soa<T> &b, quaternion_soa<T> &out, size_t begin = 0) {
+      out.resize(a.size());
+      for (size_t i = begin; i < a.size(); i++) {
+        out.set(i, a.get(i) * b.get(i));
+      }
+    }
+  template <typename T>
+    inline void qrot(const quaternion_soa<T> &q, const quaternion_soa<T> &v, quaternion_soa<T> &out, size_t begin = 0) {
+      out.resize(q.size());
+      for (size_t i = begin; i < q.size(); i++) {
+        out.set(i, qrot(q.get(i), v.get(i)));
+      }
+    }
+  template <typename T>
+    inline void normalize(const quaternion_soa<T> &q, quaternion_soa<T> &out, size_t begin = 0) {
+      out.resize(q.size());
+      for (size_t i = begin; i < q.size(); i++) {
+        out.set(i, normalize(q.get(i)));
+      }
+    }
+  template <typename T>
+    inline void compose(const transform_soa<T> &t1, const transform_soa<T> &t2, transform_soa<T> &out, size_t begin = 0) {
+      out.resize(t1.size());
+      for (size_t i = begin; i < t1.size(); i++) {
+        out.set(i, t1.get(i) * t2.get(i));
+      }
+    }
+  template <typename T>
+    inline void nlerp(const quaternion_soa<T> &a, const quaternion_soa<T> &b, const std::vector<T> &u, quaternion_soa<T> &out, size_t begin = 0) {
+      out.resize(a.size());
+      for (size_t i = begin; i < a.size(); i++) {
+        out.set(i, normalize((1 - u[i]) * a.get(i) + u[i] * b.get(i)));
+      }
+    }
+  template <typename T>
+    inline void slerp(const quaternion_soa<T> &a, const quaternion_soa<T> &b, const std::vector<T> &theta, const std::vector<T> &u,
+                      quaternion_soa<T> &out, size_t begin = 0) {
+      out.resize(a.size());
+      for (size_t i = begin; i < a.size(); i++) {
+        out.set(i, (std::sin((1 - u[i]) * theta[i]) * a.get(i) + std::sin(u[i] * theta[i]) * b.get(i)) / std::sin(theta[i]));
+      }
+    }
+  /* planes[4 * p, 4 * p + 4) = (a, b, c, d) of plane p, (a, b, c) of unit length */
+  template <typename T>
+    inline void plane_distances(const sphere_soa<T> &s, const T *planes, size_t count, std::vector<T> &out, size_t begin = 0) {
+      out.resize(s.size());
+      for (size_t i = begin; i < s.size(); i++) {
+        T d = s.r[i] + planes[0] * s.x[i] + planes[1] * s.y[i] + planes[2] * s.z[i] + planes[3];
+        for (size_t p = 1; p < count; p++) {
+          const T *plane = planes + 4 * p;
+          d = std::min(d, s.r[i] + plane[0] * s.x[i] + plane[1] * s.y[i] + plane[2] * s.z[i] + plane[3]);
+        }
+        out[i] = d;
+      }
+    }
+  template <typename T>
+    inline void to_matrices(const transform_soa<T> &t, T *out, size_t begin = 0) {
+      for (size_t i = begin; i < t.size(); i++) {
+        to_matrix(t.get(i), out + 16 * i);
+      }
+    }
+
+  namespace simd {
+    enum isa { SCALAR, SSE2, AVX2, NEON };
+
+    inline isa detect() {
+#if defined(GEOM_SIMD_AVX2)
+      __builtin_cpu_init();
+      if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return AVX2;
+      }
+#endif
+#if defined(GEOM_SIMD_SSE2)
+      return SSE2;
+#elif defined(GEOM_SIMD_NEON)
+      return NEON;
+#else
+      return SCALAR;
+#endif
+    }
+
+    inline isa& selected() {
+      static isa current = detect();
+      return current;
+    }
+
+    /* instruction set of the float kernels */
+    inline isa active() {
+      return selected();
+    }
+
+    /* force an instruction set (benchmarks, tests); one the CPU lacks falls back to detect() */
+    inline void select(isa a) {
+      isa best = detect();
+      bool supported = (a == SCALAR || a == best || (a == SSE2 && best == AVX2));
+      selected() = supported ? a : best;
+    }
+
+    inline const char* name(isa a) {
+      switch (a) {
+        case SSE2: return "sse2";
+        case AVX2: return "avx2";
+        case NEON: return "neon";
+        default:   return "scalar";
+      }
+    }
+
+#if defined(GEOM_SIMD_SSE2)
+    namespace sse2 {
+      struct vf { __m128 v; };
+      const size_t W = 4;
+      inline vf load(const float *p) { return vf { _mm_loadu_ps(p) }; }
+      inline void store(float *p, vf a) { _mm_storeu_ps(p, a.v); }
+      inline vf set1(float s) { return vf { _mm_set1_ps(s) }; }
+      inline vf operator +(vf a, vf b) { return vf { _mm_add_ps(a.v, b.v) }; }
+      inline vf operator -(vf a, vf b) { return vf { _mm_sub_ps(a.v, b.v) }; }
+      inline vf operator *(vf a, vf b) { return vf { _mm_mul_ps(a.v, b.v) }; }
+      inline vf operator /(vf a, vf b) { return vf { _mm_div_ps(a.v, b.v) }; }
+      inline vf sqrt(vf a) { return vf { _mm_sqrt_ps(a.v) }; }
+      inline vf min(vf a, vf b) { return vf { _mm_min_ps(a.v, b.v) }; }
+      // stream: non-temporal stores, out 16-byte aligned
+      template <bool stream>
+        inline void store4(float *p, __m128 a) {
+          if (stream) {
+            _mm_stream_ps(p, a);
+          } else {
+            _mm_storeu_ps(p, a);
+          }
+        }
+      template <bool stream>
+      inline void store_matrices(const vf *m, float *out) {
+        for (int column = 0; column < 4; column++) {
+          __m128 r0 = m[4 * column].v, r1 = m[4 * column + 1].v, r2 = m[4 * column + 2].v, r3 = m[4 * column + 3].v;
+          _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+          store4<stream>(out + 4 * column, r0);
+          store4<stream>(out + 16 + 4 * column, r1);
+          store4<stream>(out + 32 + 4 * column, r2);
+          store4<stream>(out + 48 + 4 * column, r3);
+        }
+      }
+#include "geom_soa_kernels.h"
+    }
+#endif
+
+#if defined(GEOM_SIMD_AVX2)
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+    namespace avx2 {
+      struct vf { __m256 v; };
+      const size_t W = 8;
+      inline vf load(const float *p) { return vf { _mm256_loadu_ps(p) }; }
+      inline void store(float *p, vf a) { _mm256_storeu_ps(p, a.v); }
+      inline vf set1(float s) { return vf { _mm256_set1_ps(s) }; }
+      inline vf operator +(vf a, vf b) { return vf { _mm256_add_ps(a.v, b.v) }; }
+      inline vf operator -(vf a, vf b) { return vf { _mm256_sub_ps(a.v, b.v) }; }
+      inline vf operator *(vf a, vf b) { return vf { _mm256_mul_ps(a.v, b.v) }; }
+      inline vf operator /(vf a, vf b) { return vf { _mm256_div_ps(a.v, b.v) }; }
+      inline vf sqrt(vf a) { return vf { _mm256_sqrt_ps(a.v) }; }
+      inline vf min(vf a, vf b) { return vf { _mm256_min_ps(a.v, b.v) }; }
+      // stream: non-temporal stores, out 32-byte aligned
+      template <bool stream>
+        inline void store8(float *p, __m256 a) {
+          if (stream) {
+            _mm256_stream_ps(p, a);
+          } else {
+            _mm256_storeu_ps(p, a);
+          }
+        }
+      // 8x8 transposes of two columns at a time: row j is columns c, c + 1 of matrix j
+      template <bool stream>
+      inline void store_matrices(const vf *m, float *out) {
+        for (int column = 0; column < 4; column += 2) {
+          const vf *a = m + 4 * column;
+          __m256 t0 = _mm256_unpacklo_ps(a[0].v, a[1].v), t1 = _mm256_unpackhi_ps(a[0].v, a[1].v);
+          __m256 t2 = _mm256_unpacklo_ps(a[2].v, a[3].v), t3 = _mm256_unpackhi_ps(a[2].v, a[3].v);
+          __m256 t4 = _mm256_unpacklo_ps(a[4].v, a[5].v), t5 = _mm256_unpackhi_ps(a[4].v, a[5].v);
+          __m256 t6 = _mm256_unpacklo_ps(a[6].v, a[7].v), t7 = _mm256_unpackhi_ps(a[6].v, a[7].v);
+          __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0)), u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+          __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0)), u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+          __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0)), u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+          __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0)), u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+          float *p = out + 4 * column;
+          store8<stream>(p,       _mm256_permute2f128_ps(u0, u4, 0x20));
+          store8<stream>(p + 16,  _mm256_permute2f128_ps(u1, u5, 0x20));
+          store8<stream>(p + 32,  _mm256_permute2f128_ps(u2, u6, 0x20));
+          store8<stream>(p + 48,  _mm256_permute2f128_ps(u3, u7, 0x20));
+          store8<stream>(p + 64,  _mm256_permute2f128_ps(u0, u4, 0x31));
+          store8<stream>(p + 80,  _mm256_permute2f128_ps(u1, u5, 0x31));
+          store8<stream>(p + 96,  _mm256_permute2f128_ps(u2, u6, 0x31));
+          store8<stream>(p + 112, _mm256_permute2f128_ps(u3, u7, 0x31));
+        }
+      }
+#include "geom_soa_kernels.h"
+    }
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+
+#if defined(GEOM_SIMD_NEON)
+    namespace neon {
+      struct vf { float32x4_t v; };
+      const size_t W = 4;
+      inline vf load(const float *p) { return vf { vld1q_f32(p) }; }
+      inline void store(float *p, vf a) { vst1q_f32(p, a.v); }
+      inline vf set1(float s) { return vf { vdupq_n_f32(s) }; }
+      inline vf operator +(vf a, vf b) { return vf { vaddq_f32(a.v, b.v) }; }
+      inline vf operator -(vf a, vf b) { return vf { vsubq_f32(a.v, b.v) }; }
+      inline vf operator *(vf a, vf b) { return vf { vmulq_f32(a.v, b.v) }; }
+      inline vf operator /(vf a, vf b) { return vf { vdivq_f32(a.v, b.v) }; }
+      inline vf sqrt(vf a) { return vf { vsqrtq_f32(a.v) }; }
+      inline vf min(vf a, vf b) { return vf { vminq_f32(a.v, b.v) }; }
+      // the NEON intrinsics have no non-temporal store, stream is ignored
+      template <bool stream>
+      inline void store_matrices(const vf *m, float *out) {
+        for (int column = 0; column < 4; column++) {
+          float32x4x2_t t01 = vtrnq_f32(m[4 * column].v, m[4 * column + 1].v);
+          float32x4x2_t t23 = vtrnq_f32(m[4 * column + 2].v, m[4 * column + 3].v);
+          vst1q_f32(out + 4 * column,      vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+          vst1q_f32(out + 16 + 4 * column, vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+          vst1q_f32(out + 32 + 4 * column, vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+          vst1q_f32(out + 48 + 4 * column, vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+        }
+      }
+#include "geom_soa_kernels.h"
+    }
+#endif
+  }
+
+// n = the number of elements done by the SIMD kernel, the scalar template does the rest
+#if defined(GEOM_SIMD_SSE2)
+#define GEOM_SIMD_X86_CASES(kernel, ...) \
+      case simd::SSE2: n = simd::sse2::kernel(__VA_ARGS__); break;
+#else
+#define GEOM_SIMD_X86_CASES(kernel, ...)
+#endif
+#if defined(GEOM_SIMD_AVX2)
+#define GEOM_SIMD_AVX2_CASES(kernel, ...) \
+      case simd::AVX2: n = simd::avx2::kernel(__VA_ARGS__); break;
+#else
+#define GEOM_SIMD_AVX2_CASES(kernel, ...)
+#endif
+#if defined(GEOM_SIMD_NEON)
+#define GEOM_SIMD_NEON_CASES(kernel, ...) \
+      case simd::NEON: n = simd::neon::kernel(__VA_ARGS__); break;
+#else
+#define GEOM_SIMD_NEON_CASES(kernel, ...)
+#endif
+#define GEOM_SIMD_DISPATCH(kernel, ...) \
+    size_t n = 0; \
+    switch (simd::active()) { \
+      GEOM_SIMD_X86_CASES(kernel, __VA_ARGS__) \
+      GEOM_SIMD_AVX2_CASES(kernel, __VA_ARGS__) \
+      GEOM_SIMD_NEON_CASES(kernel, __VA_ARGS__) \
+      default: break; \
+    }
+
+  inline void mul(const quaternion_soa<float> &a, const quaternion_soa<float> &b, quaternion_soa<float> &out) {
+    out.resize(a.size());
+    GEOM_SIMD_DISPATCH(mul, a, b, out);
+    mul<float>(a, b, out, n);
+  }
+  inline void qrot(const quaternion_soa<float> &q, const quaternion_soa<float> &v, quaternion_soa<float> &out) {
+    out.resize(q.size());
+    GEOM_SIMD_DISPATCH(qrot, q, v, out);
+    qrot<float>(q, v, out, n);
+  }
+  inline void normalize(const quaternion_soa<float> &q, quaternion_soa<float> &out) {
+    out.resize(q.size());
+    GEOM_SIMD_DISPATCH(normalize, q, out);
+    normalize<float>(q, out, n);
+  }
+  inline void compose(const transform_soa<float> &t1, const transform_soa<float> &t2, transform_soa<float> &out) {
+    out.resize(t1.size());
+    GEOM_SIMD_DISPATCH(compose, t1, t2, out);
+    compose<float>(t1, t2, out, n);
+  }
+  inline void nlerp(const quaternion_soa<float> &a, const quaternion_soa<float> &b, const std::vector<float> &u, quaternion_soa<float> &out) {
+    out.resize(a.size());
+    GEOM_SIMD_DISPATCH(nlerp, a, b, u, out);
+    nlerp<float>(a, b, u, out, n);
+  }
+  inline void slerp(const quaternion_soa<float> &a, const quaternion_soa<float> &b, const std::vector<float> &theta, const std::vector<float> &u,
+                    quaternion_soa<float> &out) {
+    out.resize(a.size());
+    GEOM_SIMD_DISPATCH(slerp, a, b, theta, u, out);
+    slerp<float>(a, b, theta, u, out, n);
+  }
+  inline void plane_distances(const sphere_soa<float> &s, const float *planes, size_t count, std::vector<float> &out) {
+    out.resize(s.size());
+    if (!count) {
+      return;
+    }
+    GEOM_SIMD_DISPATCH(plane_distances, s, planes, count, out);
+    plane_distances<float>(s, planes, count, out, n);
+  }
+  inline void to_matrices(const transform_soa<float> &t, float *out) {
+    GEOM_SIMD_DISPATCH(to_matrices<false>, t, out);
+    to_matrices<float>(t, out, n);
+  }
+  /*
+   * to_matrices() with non-temporal stores on x86: the matrices bypass the cache, which suits
+   * write-only destinations (mapped GL buffers) and arrays larger than the cache.
+   * out has to be 16-byte aligned (32 for AVX2), otherwise plain stores are used.
+   */
+  inline void stream_matrices(const transform_soa<float> &t, float *out) {
+    uintptr_t alignment = (uintptr_t) out;
+    if (alignment % 16) {
+      to_matrices(t, out);
+      return;
+    }
+    size_t n = 0;
+    switch (simd::active()) {
+#if defined(GEOM_SIMD_AVX2)
+      case simd::AVX2:
+        n = (alignment % 32) ? simd::sse2::to_matrices<true>(t, out) : simd::avx2::to_matrices<true>(t, out);
+        break;
+#endif
+#if defined(GEOM_SIMD_SSE2)
+      case simd::SSE2:
+        n = simd::sse2::to_matrices<true>(t, out);
+        break;
+#endif
+      default:
+        to_matrices(t, out);
+        return;
+    }
+#if defined(GEOM_SIMD_SSE2)
+    // the streaming stores are weakly ordered
+    _mm_sfence();
+#endif
+    to_matrices<float>(t, out, n);
+  }
+
+#undef GEOM_SIMD_DISPATCH
+#undef GEOM_SIMD_X86_CASES
+#undef GEOM_SIMD_AVX2_CASES
+#undef GEOM_SIMD_NEON_CASES
+
+  typedef quaternion_soa<float> fquaternion_soa;
+  typedef transform_soa<float> ftransform_soa;
+  typedef sphere_soa<float> fsphere_soa;
+};
+#endif
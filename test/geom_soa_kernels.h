@@ -0,0 +1,159 @@
+/*
+ * batch kernels of geom_soa.h, included once per instruction set inside its namespace.
+ *
+ * the including namespace provides:
+ *   vf, W                       vector of W floats
+ *   load(p) store(p, v) set1(s) unaligned loads and stores, broadcast
+ *   + - * / sqrt(v) min(a, b)   lane-wise arithmetic
+ *   store_matrices<stream>(m, out)  m[16] (lane i = matrix i, m[4 * column + row]) to W packed matrices
+ *
+ * every kernel processes the first n - n % W elements and returns that count; the caller
+ * finishes the rest with the scalar code. Each iteration loads before it stores, so the
+ * output may be one of the inputs.
+ */
+
+// (aw, ax, ay, az) * (bw, bx, by, bz), as quaternion<T>::operator *
+inline void qmul(vf aw, vf ax, vf ay, vf az, vf bw, vf bx, vf by, vf bz, vf &w, vf &x, vf &y, vf &z) {
+  w = aw * bw - ax * bx - ay * by - az * bz;
+  x = aw * bx + ax * bw + ay * bz - az * by;
+  y = aw * by - ax * bz + ay * bw + az * bx;
+  z = aw * bz + ax * by - ay * bx + az * bw;
+}
+
+// v + 2 q x (q x v + w v), as geom::qrot
+inline void qrot3(vf qw, vf qx, vf qy, vf qz, vf vx, vf vy, vf vz, vf &x, vf &y, vf &z) {
+  vf cx = qy * vz - qz * vy + qw * vx;
+  vf cy = qz * vx - qx * vz + qw * vy;
+  vf cz = qx * vy - qy * vx + qw * vz;
+  vf two = set1(2.0f);
+  x = vx + two * (qy * cz - qz * cy);
+  y = vy + two * (qz * cx - qx * cz);
+  z = vz + two * (qx * cy - qy * cx);
+}
+
+inline size_t mul(const quaternion_soa<float> &a, const quaternion_soa<float> &b, quaternion_soa<float> &out) {
+  size_t n = a.size() - a.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf w, x, y, z;
+    qmul(load(&a.w[i]), load(&a.x[i]), load(&a.y[i]), load(&a.z[i]),
+         load(&b.w[i]), load(&b.x[i]), load(&b.y[i]), load(&b.z[i]), w, x, y, z);
+    store(&out.w[i], w), store(&out.x[i], x), store(&out.y[i], y), store(&out.z[i], z);
+  }
+  return n;
+}
+
+inline size_t qrot(const quaternion_soa<float> &q, const quaternion_soa<float> &v, quaternion_soa<float> &out) {
+  size_t n = q.size() - q.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf w = load(&v.w[i]), x, y, z;
+    qrot3(load(&q.w[i]), load(&q.x[i]), load(&q.y[i]), load(&q.z[i]),
+          load(&v.x[i]), load(&v.y[i]), load(&v.z[i]), x, y, z);
+    store(&out.w[i], w), store(&out.x[i], x), store(&out.y[i], y), store(&out.z[i], z);
+  }
+  return n;
+}
+
+inline size_t normalize(const quaternion_soa<float> &q, quaternion_soa<float> &out) {
+  size_t n = q.size() - q.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf w = load(&q.w[i]), x = load(&q.x[i]), y = load(&q.y[i]), z = load(&q.z[i]);
+    // q / abs(q) multiplies by the reciprocal
+    vf r = set1(1.0f) / sqrt(w * w + x * x + y * y + z * z);
+    store(&out.w[i], w * r), store(&out.x[i], x * r), store(&out.y[i], y * r), store(&out.z[i], z * r);
+  }
+  return n;
+}
+
+inline size_t compose(const transform_soa<float> &t1, const transform_soa<float> &t2, transform_soa<float> &out) {
+  size_t n = t1.size() - t1.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf s = load(&t1.scale[i]);
+    vf qw = load(&t1.rot.w[i]), qx = load(&t1.rot.x[i]), qy = load(&t1.rot.y[i]), qz = load(&t1.rot.z[i]);
+    vf x, y, z, rw, rx, ry, rz;
+    qrot3(qw, qx, qy, qz, s * load(&t2.x[i]), s * load(&t2.y[i]), s * load(&t2.z[i]), x, y, z);
+    qmul(qw, qx, qy, qz, load(&t2.rot.w[i]), load(&t2.rot.x[i]), load(&t2.rot.y[i]), load(&t2.rot.z[i]), rw, rx, ry, rz);
+    vf scale = s * load(&t2.scale[i]);
+    x = x + load(&t1.x[i]), y = y + load(&t1.y[i]), z = z + load(&t1.z[i]);
+    store(&out.x[i], x), store(&out.y[i], y), store(&out.z[i], z);
+    store(&out.rot.w[i], rw), store(&out.rot.x[i], rx), store(&out.rot.y[i], ry), store(&out.rot.z[i], rz);
+    store(&out.scale[i], scale);
+  }
+  return n;
+}
+
+// sin(x) for x in [0, pi / 2]: Taylor series to x^11, error below 6e-8
+inline vf sin_quadrant(vf x) {
+  vf x2 = x * x;
+  vf p = set1(-2.5052108e-8f);
+  p = p * x2 + set1(2.7557319e-6f);
+  p = p * x2 + set1(-1.9841270e-4f);
+  p = p * x2 + set1(8.3333333e-3f);
+  p = p * x2 + set1(-1.6666667e-1f);
+  return x + x * x2 * p;
+}
+
+// wa a + wb b for elements [i, i + W)
+inline void blend(const quaternion_soa<float> &a, const quaternion_soa<float> &b, size_t i, vf wa, vf wb, vf &w, vf &x, vf &y, vf &z) {
+  w = wa * load(&a.w[i]) + wb * load(&b.w[i]);
+  x = wa * load(&a.x[i]) + wb * load(&b.x[i]);
+  y = wa * load(&a.y[i]) + wb * load(&b.y[i]);
+  z = wa * load(&a.z[i]) + wb * load(&b.z[i]);
+}
+
+inline size_t nlerp(const quaternion_soa<float> &a, const quaternion_soa<float> &b, const std::vector<float> &u, quaternion_soa<float> &out) {
+  size_t n = a.size() - a.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf s = load(&u[i]), w, x, y, z;
+    blend(a, b, i, set1(1.0f) - s, s, w, x, y, z);
+    vf r = set1(1.0f) / sqrt(w * w + x * x + y * y + z * z);
+    store(&out.w[i], w * r), store(&out.x[i], x * r), store(&out.y[i], y * r), store(&out.z[i], z * r);
+  }
+  return n;
+}
+
+inline size_t slerp(const quaternion_soa<float> &a, const quaternion_soa<float> &b, const std::vector<float> &theta, const std::vector<float> &u,
+                    quaternion_soa<float> &out) {
+  size_t n = a.size() - a.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf t = load(&theta[i]), s = load(&u[i]), w, x, y, z;
+    vf r = set1(1.0f) / sin_quadrant(t);
+    blend(a, b, i, sin_quadrant((set1(1.0f) - s) * t) * r, sin_quadrant(s * t) * r, w, x, y, z);
+    store(&out.w[i], w), store(&out.x[i], x), store(&out.y[i], y), store(&out.z[i], z);
+  }
+  return n;
+}
+
+inline size_t plane_distances(const sphere_soa<float> &s, const float *planes, size_t count, std::vector<float> &out) {
+  size_t n = s.size() - s.size() % W;
+  for (size_t i = 0; i < n; i += W) {
+    vf x = load(&s.x[i]), y = load(&s.y[i]), z = load(&s.z[i]), r = load(&s.r[i]);
+    vf d = r + set1(planes[0]) * x + set1(planes[1]) * y + set1(planes[2]) * z + set1(planes[3]);
+    for (size_t p = 1; p < count; p++) {
+      const float *plane = planes + 4 * p;
+      d = min(d, r + set1(plane[0]) * x + set1(plane[1]) * y + set1(plane[2]) * z + set1(plane[3]));
+    }
+    store(&out[i], d);
+  }
+  return n;
+}
+
+// stream: non-temporal stores, see stream_matrices()
+template <bool stream>
+inline size_t to_matrices(const transform_soa<float> &t, float *out) {
+  size_t n = t.size() - t.size() % W;
+  vf zero = set1(0.0f), one = set1(1.0f), two = set1(2.0f);
+  for (size_t i = 0; i < n; i += W) {
+    vf s = load(&t.scale[i]);
+    vf w = load(&t.rot.w[i]), x = load(&t.rot.x[i]), y = load(&t.rot.y[i]), z = load(&t.rot.z[i]);
+    vf xx = x * x, yy = y * y, zz = z * z, xy = x * y, xz = x * z, yz = y * z, xw = x * w, yw = y * w, zw = z * w;
+    // the entries of transform<T>::operator arma::Mat<T>::fixed<4, 4>()
+    vf m[16] = {
+      s * (one - two * (yy + zz)), s * (two * (xy - zw)), s * (two * (xz + yw)), zero,
+      s * (two * (xy + zw)), s * (one - two * (zz + xx)), s * (two * (yz - xw)), zero,
+      s * (two * (xz - yw)), s * (two * (yz + xw)), s * (one - two * (xx + yy)), zero,
+      load(&t.x[i]), load(&t.y[i]), load(&t.z[i]), one
+    };
+    store_matrices<stream>(m, out + 16 * i);
+  }
+  return n;
+}
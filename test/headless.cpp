@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include "HeadlessContext.h"
+#include "SimpleGLScene.h"
+
+/*
+ * render an animation sequence without a window:
+ *
+ *    $ ./qt5-opengl11-headless -w 1920 -h 1080 -n 600 -r 60 -o frames
+ *
+ * frame i is rendered at the simulated time i / rate and written to <output>/frameNNNNN.<format>,
+ * png (-z: compression level 0 .. 9) or qoi (larger files, much faster to write).
+ * the output directory has to exist.
+ */
+static void usage(const char *argv0) {
+  std::cerr << "usage: " << argv0 << " [-w width] [-h height] [-n frames] [-r frames per second] [-o output directory] [-f png|qoi] [-z compression]" << std::endl;
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int width = 800, height = 450, frames = 60;
+  double rate = 60.0;
+  int compression = 6;
+  std::string output = ".", format = "png";
+  for (int i = 1; i < argc; i++) {
+    if (i + 1 == argc || argv[i][0] != '-' || strlen(argv[i]) != 2) {
+      usage(argv[0]);
+    }
+    const char *value = argv[++i];
+    switch (argv[i - 1][1]) {
+      case 'w': width = atoi(value); break;
+      case 'h': height = atoi(value); break;
+      case 'n': frames = atoi(value); break;
+      case 'r': rate = atof(value); break;
+      case 'o': output = value; break;
+      case 'f': format = value; break;
+      case 'z': compression = atoi(value); break;
+      default: usage(argv[0]);
+    }
+  }
+  if (width <= 0 || height <= 0 || frames < 0 || rate <= 0.0 || (format != "png" && format != "qoi")) {
+    usage(argv[0]);
+  }
+
+  try {
+    HeadlessContext context;
+    context.makeCurrent();
+    SimpleGLScene scene;
+    scene.setTime(0);
+    scene.init();
+    // every saved frame is rendered with the final shaders
+    scene.waitUntilReady();
+
+    // the scene renders into this texture instead of a window
+    OpenGL11::Texture2D outputTexture(GL_RGBA8);
+    OpenGL11::Framebuffer outputFramebuffer;
+    outputTexture.allocate(width, height);
+    outputFramebuffer.attach(GL_COLOR_ATTACHMENT0, outputTexture);
+    scene.setDefaultFramebuffer(outputFramebuffer.id());
+    scene.resize(width, height);
+    // readback is asynchronous and the images are encoded on worker threads
+    OpenGL11::ImageCapture capture;
+    capture.setCompression(compression);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t updatedNodes = 0, visible = 0, culled = 0;
+    for (int i = 0; i < frames; i++) {
+      scene.setTime((int64_t) (i * 1000.0 / rate));
+      scene.update();
+      updatedNodes += scene.updatedSceneNodes();
+      scene.render();
+      visible += scene.visibleInstances();
+      culled += scene.culledInstances();
+      char filename[32];
+      snprintf(filename, sizeof(filename), "/frame%05d.%s", i, format.c_str());
+      capture.save(outputTexture, output + filename);
+    }
+    capture.finish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << frames << " frames in " << seconds << " s (" << frames / seconds << " frames/s), "
+              << updatedNodes << " scene graph nodes updated" << std::endl;
+    if (frames) {
+      std::cout << "per frame: " << visible / frames << " primitives visible, " << culled / frames << " culled" << std::endl;
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
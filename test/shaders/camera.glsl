@@ -0,0 +1,4 @@
+// bound to SimpleGLScene::CAMERA_BINDING
+layout(std140) uniform Camera {
+  mat4 proj, view;
+};
@@ -0,0 +1,28 @@
+#version 330 core
+// half resolution color (rgb) and circle of confusion (a)
+uniform sampler2D tex_color;
+uniform sampler2D tex_depth;
+uniform int width;
+uniform int height;
+
+out vec4 frag_color;
+
+float dof_factor(float z, float focus, float depth) {
+  return abs(1.0/z - 1.0/focus) / (1.0 / (focus + depth) - 1.0 / focus);
+}
+
+float dof_modifier(float f) {
+  return f * f;
+}
+
+void main () {
+  // the center of a half resolution pixel is the shared corner of 2x2 full resolution pixels,
+  // so one bilinear fetch averages their color; depth is not filtered across edges.
+  vec2 uv = gl_FragCoord.xy / vec2(width, height);
+  ivec2 p = 2 * ivec2(gl_FragCoord.xy);
+  float coc = max(max(dof_factor(texelFetch(tex_depth, p, 0).r, 0.92, 0.2),
+                      dof_factor(texelFetch(tex_depth, p + ivec2(1, 0), 0).r, 0.92, 0.2)),
+                  max(dof_factor(texelFetch(tex_depth, p + ivec2(0, 1), 0).r, 0.92, 0.2),
+                      dof_factor(texelFetch(tex_depth, p + ivec2(1, 1), 0).r, 0.92, 0.2)));
+  frag_color = vec4(texture(tex_color, uv).rgb, clamp(dof_modifier(coc), 0.0, 1.0));
+}
@@ -1,13 +1,21 @@
 #version 330 core
 #define PI 3.14159216
 uniform sampler2D tex_color;
+uniform sampler2D tex_blur;
+uniform sampler2D tex_coc;
 uniform int width;
 uniform int height;
 
 vec2 texel;
 
+// blend the sharp and the blurred image by the circle of confusion (at half resolution)
 vec3 color(vec2 c) {
-  return texture2D(tex_color, vec2(texel.x * c.x, texel.y * c.y)).rgb;
+  vec2 uv = vec2(texel.x * c.x, texel.y * c.y);
+#ifdef NO_DEPTH_OF_FIELD
+  return texture2D(tex_color, uv).rgb;
+#else
+  return mix(texture2D(tex_color, uv).rgb, texture2D(tex_blur, uv).rgb, texture2D(tex_coc, uv).a);
+#endif
 }
 
 float gamma(float c) {
@@ -1,14 +1,19 @@
 #version 330
  
-uniform mat4 view, proj, model;
+#include "camera.glsl"
 
-uniform float r, width, helix_angle, num_v, angle, len, slope_angle;
-uniform int program;
+// PRIMITIVE is defined by SimpleGLScene: 0 line, 1 helix, 2 clothoid (enum Primitive)
+uniform float num_v;
 in vec2 pos;
+// per instance
+in mat4 model;
+// helix: (r, width, angle, helix_angle), line: (width, len, 0, 0), clothoid: (width, angle, slope_angle, len)
+in vec4 params;
 out vec4 normal;
 out vec3 c;
 
 void helix() {
+  float r = params.x, width = params.y, angle = params.z, helix_angle = params.w;
   vec4 tmp;
   float phi = 0.4;
   float x = (2.0 * angle / num_v) * pos.y, y = pos.x;
@@ -24,6 +29,7 @@ void helix() {
 }
 
 void line() {
+  float width = params.x, len = params.y;
   vec4 tmp;
   float x, y;
   float phi = 0.4;
@@ -41,6 +47,7 @@ void line() {
 }
 
 void clothoid() {
+  float width = params.x, angle = params.y, slope_angle = params.z, len = params.w;
   vec4 tmp;
   float x, y, a, p, slope_a, q, z;
   x = (2.0 * len / num_v) * pos.y;
@@ -61,7 +68,11 @@ void clothoid() {
 }
 
 void main() {
-  if (program == 0) line();
-  if (program == 1) helix();
-  if (program == 2) clothoid();
+#if PRIMITIVE == 0
+  line();
+#elif PRIMITIVE == 1
+  helix();
+#else
+  clothoid();
+#endif
 }
@@ -0,0 +1,17 @@
+#version 330 core
+// dual Kawase downsampling: width, height are the size of the target, half the size of tex_color
+uniform sampler2D tex_color;
+uniform int width;
+uniform int height;
+
+out vec4 frag_color;
+
+void main () {
+  vec2 hp = 0.5 / vec2(width, height);
+  vec2 uv = gl_FragCoord.xy / vec2(width, height);
+  frag_color = (4.0 * texture(tex_color, uv) +
+                texture(tex_color, uv - hp) +
+                texture(tex_color, uv + hp) +
+                texture(tex_color, uv + vec2(hp.x, -hp.y)) +
+                texture(tex_color, uv - vec2(hp.x, -hp.y))) / 8.0;
+}
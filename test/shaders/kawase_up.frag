@@ -0,0 +1,20 @@
+#version 330 core
+// dual Kawase upsampling: width, height are the size of the target, twice the size of tex_color
+uniform sampler2D tex_color;
+uniform int width;
+uniform int height;
+
+out vec4 frag_color;
+
+void main () {
+  vec2 hp = 0.5 / vec2(width, height);
+  vec2 uv = gl_FragCoord.xy / vec2(width, height);
+  frag_color = (texture(tex_color, uv + vec2(-2.0 * hp.x, 0.0)) +
+                texture(tex_color, uv + vec2( 2.0 * hp.x, 0.0)) +
+                texture(tex_color, uv + vec2(0.0, -2.0 * hp.y)) +
+                texture(tex_color, uv + vec2(0.0,  2.0 * hp.y)) +
+                2.0 * texture(tex_color, uv + vec2(-hp.x,  hp.y)) +
+                2.0 * texture(tex_color, uv + vec2( hp.x,  hp.y)) +
+                2.0 * texture(tex_color, uv + vec2(-hp.x, -hp.y)) +
+                2.0 * texture(tex_color, uv + vec2( hp.x, -hp.y))) / 12.0;
+}